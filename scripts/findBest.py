@@ -14,10 +14,16 @@ if __name__ == "__main__":
         reader = csv.DictReader(csvfile)
         rows = list(reader)
 
+    # Extra benchmark dimensions, compared separately. Older CSVs won't have these columns.
+    dimensions = ["size distribution", "memory budget", "key format", "insertion order", "file system"]
+
     groups = {}
     for row in rows:
         for field in ["records", "sum", "min", "max", "avg"]:
             row[field] = int(row[field])
+        # Treat each combination of extra dimensions like separate hardware
+        variant = [row[d] for d in dimensions if row.get(d) not in (None, "", "uniform", "default", "hex", "random")]
+        row["hardware"] = " ".join([row["hardware"]] + variant)
         key = (row["hardware"], row["data type"], row["op"], row["size"], row["records"])
         if key not in groups:
             groups[key] = []
@@ -39,7 +45,7 @@ if __name__ == "__main__":
         matrix[rowKey][records] = bestList
 
     def sortFunc(key):
-        opOrder = ["insert", "update", "get", "remove", "space", "memory"]
+        opOrder = ["insert", "update", "append", "read-modify-write", "get", "remove", "space", "memory"]
         sizeOrder = ["1B to 1KiB", "1KiB to 10KiB", "10KiB to 100KiB", "100KiB to 1MiB"]
         dataTypeOrder = ["incompressible", "compressible"]
 
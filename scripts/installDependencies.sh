@@ -20,6 +20,7 @@ fi
     boost-process \
     boost-uuid \
     doctest \
+    benchmark \
 
 # if [ ! -d "build/berkeleydb" ]; then
 #     mkdir -p build
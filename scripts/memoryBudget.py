@@ -0,0 +1,54 @@
+#!/usr/bin/env python3
+"""
+Shows how each store degrades as its memory budget shrinks. For each store and usage pattern, prints the average of
+each op at each memory budget, and how many times slower it is than with the largest budget (or the engine defaults
+if the benchmark ran with them).
+
+Usage: scripts/memoryBudget.py out/benchmarks/benchmark<timestamp>.csv
+"""
+
+from pathlib import Path
+import sys
+import csv
+
+
+def budgetBytes(budget):
+    """ Sorts "default" above any explicit budget """
+    if budget == "default": return float("inf")
+    units = {"B": 1, "KiB": 1024, "MiB": 1024 ** 2, "GiB": 1024 ** 3}
+    for unit, size in sorted(units.items(), key = lambda u: -len(u[0])):
+        if budget.endswith(unit):
+            return float(budget[:-len(unit)]) * size
+    return float(budget)
+
+
+if __name__ == "__main__":
+    benchmark = Path(sys.argv[1])
+
+    with open(benchmark, newline='') as csvfile:
+        rows = list(csv.DictReader(csvfile))
+
+    # {(hardware, store, op, size, records, data type, size distribution, key format, insertion order, file system):
+    #     {budget: avg}}
+    groups = {}
+    for row in rows:
+        if row["op"] in ("memory", "space"): continue
+        key = (row["hardware"], row["store"], row["op"], row["size"], row["records"], row["data type"],
+               row.get("size distribution", "uniform"), row.get("key format", "hex"),
+               row.get("insertion order", "random"), row.get("file system", ""))
+        groups.setdefault(key, {})[row.get("memory budget", "default")] = float(row["avg"])
+
+    budgets = sorted({b for byBudget in groups.values() for b in byBudget}, key = budgetBytes, reverse = True)
+    print("hardware,store,op,size,records,data type,size distribution,key format,insertion order,file system," +
+          ",".join(f"{b} (μs),{b} slowdown" for b in budgets))
+    for key, byBudget in sorted(groups.items()):
+        baseline = byBudget.get(budgets[0])
+        cells = []
+        for budget in budgets:
+            avg = byBudget.get(budget)
+            if avg is None:
+                cells += ["", ""]
+            else:
+                slowdown = f"{avg / baseline:.2f}x" if baseline else ""
+                cells += [f"{avg / 1000:.1f}", slowdown]
+        print(",".join(list(key) + cells))
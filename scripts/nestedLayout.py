@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+"""
+Compares the nested folder layouts: the fixed 3 levels of 2 characters ("NestedFolder"), the layout picked from the
+record count ("NestedFolderAuto"), and splitting directories as they fill up ("NestedFolderResharding"). For each op
+and usage pattern, prints the average of each layout and how many times faster it is than the fixed layout.
+
+Usage: scripts/nestedLayout.py out/benchmarks/benchmark<timestamp>.csv
+"""
+
+from pathlib import Path
+import sys
+import csv
+
+LAYOUTS = ["NestedFolder", "NestedFolderAuto", "NestedFolderResharding"]
+
+
+if __name__ == "__main__":
+    benchmark = Path(sys.argv[1])
+
+    with open(benchmark, newline='') as csvfile:
+        rows = [row for row in csv.DictReader(csvfile) if row["store"] in LAYOUTS]
+
+    # {(hardware, op, size, records, data type, size distribution, memory budget, key format, insertion order,
+    #   file system): {store: avg}}
+    groups = {}
+    for row in rows:
+        key = (row["hardware"], row["op"], row["size"], row["records"], row["data type"],
+               row.get("size distribution", "uniform"), row.get("memory budget", "default"),
+               row.get("key format", "hex"), row.get("insertion order", "random"), row.get("file system", ""))
+        groups.setdefault(key, {})[row["store"]] = float(row["avg"])
+
+    print("hardware,op,size,records,data type,size distribution,memory budget,key format,insertion order,file system," +
+          ",".join(f"{l},{l} speedup" for l in LAYOUTS))
+    for key, byStore in sorted(groups.items()):
+        fixed = byStore.get(LAYOUTS[0])
+        cells = []
+        for layout in LAYOUTS:
+            avg = byStore.get(layout)
+            if avg is None:
+                cells += ["", ""]
+            elif key[1] in ("memory", "space"): # not times, higher space efficiency is better
+                cells += [f"{avg:g}", ""]
+            else:
+                cells += [f"{avg / 1000:.1f}", f"{fixed / avg:.2f}x" if fixed and avg else ""]
+        print(",".join(list(key) + cells))
@@ -9,9 +9,23 @@
 #include <sstream>
 #include <algorithm>
 #include <functional>
+#include <map>
+#include <set>
+#include <thread>
+#include <optional>
+#include <typeinfo>
+#include <type_traits>
+
+#include "rocksdb/table.h"
+#include "rocksdb/cache.h"
+#include "rocksdb/write_buffer_manager.h"
+#include "rocksdb/env.h"
 
 #include "stores.h"
 #include "utils.h"
+#include "trace.h"
+#include "samples.h"
+#include "metrics.h"
 
 #define DOCTEST_CONFIG_IMPLEMENT
 #include "doctest/doctest.h"
@@ -33,18 +47,113 @@ struct UsagePattern {
     Range<size_t> count;
     /** One of "compressible", "incompressible" */
     string dataType;
+    /** Name of the distribution sizes are picked from within the size range */
+    string sizeDistribution = "uniform";
+    /** Memory budget in bytes for the store's caches and buffers. 0 to use each engine's defaults */
+    size_t memoryBudget = 0;
+    /** How keys are encoded and the order they are inserted in, see `utils::KeyGenerator` */
+    string keyFormat = "hex";
+    string insertionOrder = "random";
+
+    /** The memory budget for display, e.g. "64MiB" or "default" */
+    string memoryBudgetName() const {
+        return memoryBudget > 0 ? utils::prettySize(memoryBudget) : "default";
+    }
+};
+
+/** How many samples `Benchmark::run` takes of each op */
+struct SamplingOptions {
+    /** Ops to run before measuring each op, to warm up caches. They aren't recorded. */
+    size_t warmup = 0;
+    /**
+     * Keep sampling until the confidence interval is within this relative error of the estimate, e.g. 0.05 for 5%.
+     * 0 to always take `Benchmark::repeats` samples.
+     */
+    double targetError = 0;
+    /** The statistic to get a confidence interval for: 0 for the mean, or a percentile, e.g. 99 */
+    double percentile = 0;
+    double confidence = 0.95;
+    /** Bounds on the number of samples when sampling until the target error */
+    size_t minSamples = 30;
+    size_t maxSamples = 100'000;
+    /** Stop sampling an op after this long even if the target error hasn't been reached */
+    chrono::seconds timeBudget{60};
+};
+
+/** Options for the `churn` steady-state mode */
+struct ChurnOptions {
+    /** Stop after running for this long */
+    chrono::seconds duration;
+    /** Stop after this many ops. 0 for no limit */
+    size_t maxOps;
+    /** Relative weights of "insert", "update", "remove", and "get" in the workload */
+    std::map<string, double> mix;
+    /** How often to measure disk usage. 0 to never measure it. Time spent measuring is excluded from the timeseries */
+    chrono::seconds spaceInterval;
+};
+
+/** Options for the `expire` mode */
+struct ExpireOptions {
+    /** Number of bulk deletes to run */
+    size_t batches;
+    /** Fraction of the initial records each batch deletes */
+    double fraction;
+    /** "range" to delete a contiguous range of keys with `Store::removeRange`, or "keys" to delete randomly picked
+     * keys with `Store::bulkRemove` */
+    string method;
+};
+
+/** Options for the `openloop` mode */
+struct OpenLoopOptions {
+    /** Target arrival rates to sweep, in ops per second */
+    vector<double> rates;
+    /** How long to run at each rate */
+    chrono::seconds duration;
+    /** "poisson" for exponentially distributed gaps between arrivals, or "fixed" for evenly spaced arrivals */
+    string arrival;
+    /** Relative weights of "insert", "update", and "get" in the workload */
+    std::map<string, double> mix;
+    /** A rate is saturated if the achieved throughput is less than this fraction of the target */
+    double saturationThreshold;
+};
+
+/** Options for the `readscaling` mode */
+struct ReadScalingOptions {
+    /** Numbers of reader threads to measure */
+    vector<unsigned> readers;
+    /** How long to run each number of readers */
+    chrono::seconds duration;
+    /** Whether a writer thread updates records the whole time */
+    bool writer;
 };
 
-/** A callable that generates random data for use as a value in the store */
-using DataGenerator = function<string(Range<size_t>)>;
+/** Options for the `compare` mode */
+struct CompareOptions {
+    /** Only rerun the baseline's combinations of these stores, or all of them if empty */
+    vector<string> stores;
+    /** Only rerun the baseline's combinations with these minimum record counts, or all of them if empty */
+    vector<size_t> records;
+    /** Where to record the samples of the rerun, so it can be the baseline of a later comparison */
+    path samplesPath;
+    /** A difference is significant if the Mann-Whitney U test's p value is below this */
+    double alpha;
+    /** A significant difference is a regression if the median latency got slower by more than this fraction */
+    double threshold;
+};
+
+/** A callable that generates random data of the given size for use as a value in the store */
+using DataGenerator = function<string(size_t)>;
+/** A callable that generates a random value with its size picked from the range by a size distribution */
+using ValueGenerator = function<string(Range<size_t>)>;
+using SizeDistributionPtr = std::shared_ptr<utils::SizeDistribution>;
 /** A callable that creates a new store from (storeType, filepath, pattern). */
 using StoreFactory = function<StorePtr(string, path, const UsagePattern&)>;
 
 /** This class runs the actual benchmark */
 class Benchmark {
 public:
-    /** Directory to save the stores */
-    path storeDir;
+    /** Directories to save the stores in, e.g. on different file systems. Each is a benchmark dimension. */
+    const vector<path> storeDirs;
 
     /** Name of the system the benchmark is running on */
     string hardware;
@@ -73,21 +182,201 @@ public:
     /** Incompressible vs compressible data */
     const vector<pair<string, DataGenerator>> dataTypes;
 
+    /** How sizes are distributed within each size range, e.g. uniform or log-normal */
+    const vector<pair<string, SizeDistributionPtr>> sizeDistributions;
+
+    /** Memory budgets to give each store, see `UsagePattern::memoryBudget` */
+    const vector<size_t> memoryBudgets;
+
+    /** Key formats and insertion orders to test, see `utils::KeyGenerator` */
+    const vector<string> keyFormats;
+    const vector<string> insertionOrders;
+
+    /**
+     * If set, the process runs in this cgroup and each combination is limited to its memory budget on top of what
+     * the process was already using. This also limits the kernel page cache, which is all the file stores have.
+     */
+    std::shared_ptr<utils::MemoryCgroup> memoryCgroup = nullptr;
+
+    /**
+     * If set, every op the benchmark runs is recorded to a trace. Each store `initStore` creates gets its own trace
+     * next to this path, see `startTrace`, so each one can be replayed against a single store.
+     */
+    path tracePath = {};
+
+    /** The trace of the current store, if tracePath is set */
+    std::shared_ptr<trace::TraceWriter> traceWriter = nullptr;
+
+    /** The number of traces started so far */
+    size_t traces = 0;
+
+    /** If set, every timed op in `run` is recorded to this samples file, along with the aggregated measurements */
+    std::shared_ptr<samples::SampleWriter> sampleWriter = nullptr;
+
+    /** If set, the current combination and every timed op in `run` are exported as live metrics */
+    std::shared_ptr<metrics::MetricsExporter> metricsExporter = nullptr;
+
+    /** Warmup and when to stop sampling each op in `run` */
+    SamplingOptions sampling = {};
+
+    /** The directory the stores are currently being saved in, inside one of storeDirs, see `useStoreDir` */
+    path storeDir = {};
+
+    /** The file system storeDir is on */
+    utils::FileSystemInfo fileSystem = {};
+
+    /** Generates the keys for the current pattern from their index. Set by `initStore`. */
+    utils::KeyGenerator genKey = {};
+
+    /** Set while running warmup ops, which aren't recorded as samples */
+    bool warmingUp = false;
+
+    /** The samples of an op */
+    struct Measurement {
+        Stats stats;
+        utils::ConfidenceInterval ci;
+    };
+
+    /** Records an op if we are recording a trace. Call after timing the op. */
+    void traceOp(trace::Op op, const string& key, size_t valueSize = 0) {
+        if (traceWriter) traceWriter->write(op, key, valueSize);
+    }
+
+    /**
+     * Records a timed op if we are recording samples, and in the live metrics. Warmup ops only count towards the
+     * metrics. Call after timing the op.
+     */
+    void sampleOp(uint64_t combination, trace::Op op, size_t keyIndex, size_t valueSize, chrono::nanoseconds time) {
+        if (sampleWriter && !warmingUp) sampleWriter->sample(combination, op, keyIndex, valueSize, time);
+        if (metricsExporter) metricsExporter->record(op, time);
+    }
+
+    /** The confidence interval for the statistic picked in `sampling`. May reorder latencies. */
+    utils::ConfidenceInterval confidenceInterval(vector<long long>& latencies) const {
+        if (sampling.percentile > 0)
+            return utils::percentileConfidenceInterval(latencies, sampling.percentile, sampling.confidence);
+        return utils::meanConfidenceInterval(latencies, sampling.confidence);
+    }
+
+    /**
+     * Runs `sampling.warmup` untimed ops, then samples an op until its confidence interval is within
+     * `sampling.targetError` or the time budget is used up, or `repeats` times if there is no target error.
+     * sampleOnce runs the op once and returns how long it took.
+     */
+    Measurement measure(const function<chrono::nanoseconds()>& sampleOnce) {
+        warmingUp = true;
+        for (size_t i = 0; i < sampling.warmup; i++)
+            sampleOnce();
+        warmingUp = false;
+
+        bool adaptive = sampling.targetError > 0;
+        size_t maxSamples = adaptive ? sampling.maxSamples : repeats;
+        size_t nextCheck = sampling.minSamples;
+        auto start = chrono::steady_clock::now();
+        vector<long long> latencies;
+        while (latencies.size() < maxSamples) {
+            latencies.push_back(sampleOnce().count());
+            if (adaptive && latencies.size() >= nextCheck) {
+                vector<long long> sorted = latencies;
+                if (confidenceInterval(sorted).relativeError() <= sampling.targetError ||
+                        chrono::steady_clock::now() - start >= sampling.timeBudget)
+                    break;
+                nextCheck = latencies.size() * 11 / 10 + 1; // check as the samples grow by 10% to keep it cheap
+            }
+        }
+
+        Measurement measurement;
+        measurement.stats.recordAll(latencies);
+        measurement.ci = confidenceInterval(latencies);
+        return measurement;
+    }
+
+    /**
+     * The subdirectory created in each of storeDirs to save the stores in. The store dirs may be mount points or have
+     * other files, so the benchmark only ever deletes this.
+     */
+    inline static const string STORE_SUBDIR = "kv-benchmark-stores";
+
+    /** Saves stores in a fresh STORE_SUBDIR of dir from now on */
+    void useStoreDir(const path& dir) {
+        storeDir = dir / STORE_SUBDIR;
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+        fileSystem = utils::fileSystemInfo(storeDir);
+    }
+
+    /** `initStore` inserts in batches of at most this many bytes of values, so they fit in small memory budgets */
+    inline static const size_t INIT_BATCH_BYTES = 4 * MiB;
+
+    /**
+     * What the harness itself may allocate while a store runs, which the cgroup counts against the limit too: an
+     * `initStore` batch and the copies the stores make of it, and the values of a few ops.
+     */
+    inline static const size_t HARNESS_HEADROOM = 16 * MiB;
+
+    /**
+     * Limits memoryCgroup, if there is one, to pattern's memory budget on top of what the process is using now, plus
+     * HARNESS_HEADROOM and harnessBytes (e.g. churn's list of live keys) so small budgets squeeze the store rather
+     * than OOM-kill the benchmark. The store can use whatever headroom the harness doesn't, so the budget is only
+     * accurate to within that much.
+     */
+    void limitMemory(const UsagePattern& pattern, size_t harnessBytes = 0) {
+        if (memoryCgroup) {
+            size_t limit = memoryCgroup->usage() + pattern.memoryBudget + HARNESS_HEADROOM + harnessBytes;
+            memoryCgroup->limit(pattern.memoryBudget > 0 ? limit : 0);
+        }
+    }
+
+    /** Combines a data generator with a distribution of sizes */
+    static ValueGenerator makeValueGenerator(DataGenerator dataGen, SizeDistributionPtr sizeDist) {
+        return [dataGen, sizeDist](Range<size_t> size) { return dataGen((*sizeDist)(size)); };
+    }
+
 
     /** Picks a random key from the store */
     string pickKey(const StorePtr& store) const {
-        return utils::genKey(utils::randInt<size_t>(0, store->count() - 1));
+        return genKey(pickKeyIndex(store));
     }
 
-    StorePtr initStore(string storeType, const UsagePattern& pattern, DataGenerator dataGen) {
+    /** Like `pickKey`, but returns the index passed to `genKey` */
+    size_t pickKeyIndex(const StorePtr& store) const {
+        return utils::randInt<size_t>(0, store->count() - 1);
+    }
+
+    /**
+     * Starts recording ops to a new trace for a new store, e.g. out/ops.trace gets out/ops.1.RocksDB.trace, then
+     * out/ops.2.LevelDB.trace, and so on
+     */
+    void startTrace(const string& storeType) {
+        traceWriter.reset(); // finish the previous one
+        path filepath = tracePath.parent_path() / tracePath.stem();
+        filepath += "." + to_string(++traces) + "." + storeType + tracePath.extension().native();
+        std::cout << "Recording the ops of " << storeType << " to " << filepath.native() << "\n";
+        traceWriter = std::make_shared<trace::TraceWriter>(filepath);
+    }
+
+    /**
+     * Creates a store with pattern.count.min records, and sets genKey to pattern's key format. Optionally pass
+     * valueSizes to get the size of each record.
+     */
+    StorePtr initStore(string storeType, const UsagePattern& pattern, ValueGenerator valueGen,
+                       vector<size_t>* valueSizes = nullptr) {
+        if (!tracePath.empty())
+            startTrace(storeType);
+        genKey = utils::KeyGenerator(pattern.keyFormat, pattern.insertionOrder);
         StorePtr store = storeFactory(storeType, storeDir / storeType, pattern);
-        int batchSize = 500;
-        for (size_t i = 0; i < pattern.count.min; i += batchSize) { // insert in 100 item batches
+        if (valueSizes) valueSizes->clear();
+        for (size_t i = 0; i < pattern.count.min;) { // insert in batches of 500 records or INIT_BATCH_BYTES
             vector<pair<string, string>> batch;
-            for (size_t j = i; j < std::min(pattern.count.min, i + batchSize); j++) {
-                batch.push_back({utils::genKey(j), dataGen(pattern.size)});
+            size_t batchBytes = 0;
+            for (; i < pattern.count.min && batch.size() < 500 && batchBytes < INIT_BATCH_BYTES; i++) {
+                batch.push_back({genKey(i), valueGen(pattern.size)});
+                batchBytes += batch.back().second.size();
+                if (valueSizes) valueSizes->push_back(batch.back().second.size());
             }
             store->bulkInsert(batch);
+            for (auto& [key, value] : batch)
+                traceOp(trace::Op::Insert, key, value.size());
         }
         return store;
     }
@@ -99,132 +388,985 @@ public:
         // inserts so we can measure size on disk and then reopen or regenerate it to benchmark update/remove.
         size_t dataSize = 0;
         for (size_t i = 0; i < store->count(); i++) {
-            dataSize += store->get(utils::genKey(i)).size();
+            dataSize += store->get(genKey(i)).size();
         }
         return dataSize;
     }
 
-    inline static const string CSV_HEADER = "hardware,store,op,size,records,data type,measurements,sum,min,max,avg\n";
-    string getCSVRow(const string& store, const string& op, const UsagePattern& pattern, const Stats& stats) {
-        return hardware + "," + store + "," + op + "," +
+    /** Size of the suffix appended to records by the append op, like a small log entry */
+    inline static const size_t APPEND_SIZE = 64;
+
+    /** Engine counters from `Store::engineStats` that get their own CSV column. Empty if the store doesn't have it. */
+    inline static const vector<string> ENGINE_STATS = {
+        "block cache hit rate", "bloom filter useful", "memtable hits", "compaction bytes", "write stall micros",
+        "block reads", "bytes read", "bytes written", "directory splits", "files moved",
+    };
+
+    inline static const string CSV_HEADER = "hardware,store,op,size,records,data type,size distribution,memory budget,"
+        "key format,insertion order,file system,mount options,"
+        "measurements,sum,min,max,avg,ci statistic,ci low,ci high,ci error," +
+        utils::join(ENGINE_STATS, ",") + "\n";
+    string getCSVRow(const string& store, const string& op, const UsagePattern& pattern, const Stats& stats,
+                     const std::map<string, double>& engineStats = {},
+                     const std::optional<utils::ConfidenceInterval>& ci = std::nullopt) {
+        return getCSVRow(hardware, fileSystem.type, fileSystem.options, store, op, pattern, stats, engineStats, ci);
+    }
+
+    static string getCSVRow(const string& hardware, const string& fileSystem, const string& mountOptions,
+                            const string& store, const string& op, const UsagePattern& pattern, const Stats& stats,
+                            const std::map<string, double>& engineStats = {},
+                            const std::optional<utils::ConfidenceInterval>& ci = std::nullopt) {
+        string options = mountOptions;
+        std::replace(options.begin(), options.end(), ',', ';'); // keep the options in one column
+        string row = hardware + "," + store + "," + op + "," +
             utils::prettySize(pattern.size.min) + " to " + utils::prettySize(pattern.size.max + 1) + "," +
             to_string(pattern.count.min) + "," +
             pattern.dataType + "," +
+            pattern.sizeDistribution + "," +
+            pattern.memoryBudgetName() + "," +
+            pattern.keyFormat + "," +
+            pattern.insertionOrder + "," +
+            fileSystem + "," +
+            options + "," +
             to_string(stats.count()) + "," +
             to_string(stats.sum()) + "," +
             to_string(stats.min()) + "," +
             to_string(stats.max()) + "," +
-            to_string(stats.avg()) + "\n";
+            to_string(stats.avg()) + ",";
+        if (ci) {
+            row += ci->statistic + "," + utils::formatNumber(ci->low) + "," + utils::formatNumber(ci->high) + "," +
+                utils::formatNumber(ci->relativeError());
+        } else {
+            row += ",,,";
+        }
+        for (auto& stat : ENGINE_STATS) {
+            auto it = engineStats.find(stat);
+            row += "," + (it != engineStats.end() ? utils::formatNumber(it->second) : "");
+        }
+        return row + "\n";
     }
 
-    /** Runs the benchmark. Pass the output stream to save CSV data to */
+    /** Runs the benchmark in each of storeDirs. Pass the output stream to save CSV data to */
     void run(std::ostream& output) {
-        fs::remove_all(storeDir); // clear the storeDir
-        fs::create_directories(storeDir);
         output << CSV_HEADER;
 
         utils::resetPeakMemUsage();
         size_t baseMemUsage = utils::getPeakMemUsage(); // We'll subtract the base from future measurements
 
+        for (auto& dir : storeDirs) {
+            useStoreDir(dir);
+            std::cout << "Saving stores in " << storeDir.native() << " (" << fileSystem.type << " "
+                      << fileSystem.options << ")\n";
+            runCombinations(output, baseMemUsage);
+            fs::remove_all(storeDir);
+        }
+    }
+
+    /** Runs every combination in the current storeDir */
+    void runCombinations(std::ostream& output, size_t baseMemUsage) {
         for (auto storeType : storeTypes)
         for (auto [dataType, dataGen] : dataTypes)
+        for (auto [sizeDistName, sizeDist] : sizeDistributions)
+        for (auto memoryBudget : memoryBudgets)
+        for (auto keyFormat : keyFormats)
+        for (auto insertionOrder : insertionOrders)
         for (auto sizeRange : sizeRanges)
         for (auto countRange : countRanges) {
-            UsagePattern pattern{sizeRange, countRange, dataType};
+            if (insertionOrder != "random" && !utils::KeyGenerator::hasOrder(keyFormat))
+                continue; // the same keys as the random order, see `warnUnorderedKeyFormats`
+            UsagePattern pattern{sizeRange, countRange, dataType, sizeDistName, memoryBudget, keyFormat,
+                                 insertionOrder};
+            ValueGenerator valueGen = makeValueGenerator(dataGen, sizeDist);
 
             size_t avgRecordSize = (sizeRange.min + sizeRange.max) / 2;
             size_t predictedSize = avgRecordSize * std::min(countRange.min + repeats, countRange.max);
-            if (predictedSize < maxDbSize) { // Skip combinations that are very large
-                std::cout << storeType << ", " << dataType << ", "
-                          << utils::prettySize(sizeRange.min) << " to " << utils::prettySize(sizeRange.max + 1) << ", "
-                          << countRange.min << " to " << countRange.max << "\n";
+            if (predictedSize >= fileSystem.available) {
+                // Small file systems like tmpfs can't hold the larger combinations
+                std::cout << "Skipping " << storeType << ", " << utils::prettySize(sizeRange.min) << " to "
+                          << utils::prettySize(sizeRange.max + 1) << ", " << countRange.min << " to "
+                          << countRange.max << " as it won't fit on " << fileSystem.mountPoint << "\n";
+            } else if (predictedSize < maxDbSize) { // Skip combinations that are very large
+                runCombination(output, baseMemUsage, storeType, pattern, valueGen);
+            }
+        }
+    }
 
-                utils::resetPeakMemUsage();
+    /**
+     * Runs a single combination in the current storeDir and writes its CSV rows. Returns its id in the samples file,
+     * or 0 if samples aren't being recorded.
+     */
+    uint64_t runCombination(std::ostream& output, size_t baseMemUsage, const string& storeType,
+                        const UsagePattern& pattern, ValueGenerator valueGen) {
+        std::cout << storeType << ", " << pattern.dataType << ", " << pattern.sizeDistribution << ", "
+                  << pattern.memoryBudgetName() << ", " << pattern.keyFormat << " " << pattern.insertionOrder
+                  << " keys, " << utils::prettySize(pattern.size.min) << " to "
+                  << utils::prettySize(pattern.size.max + 1) << ", " << pattern.count.min << " to "
+                  << pattern.count.max << "\n";
 
-                StorePtr store = initStore(storeType, pattern, dataGen);
+        limitMemory(pattern);
+        utils::resetPeakMemUsage();
 
-                Stats insertStats;
-                for (int rep = 0; rep < repeats; rep++) {
-                    if (store->count() >= countRange.max) { // on small sizes repeat may be more than size range
-                        store.reset(); // close the store first (LevelDB has a lock)
-                        store = initStore(storeType, pattern, dataGen);
-                    }
-                    string key = utils::genKey(store->count());
-                    string value = dataGen(sizeRange);
-                    auto time = utils::timeIt([&]() { store->insert(key, value); });
-                    insertStats.record(time.count());
-                }
+        uint64_t combination = 0;
+        if (sampleWriter) {
+            combination = sampleWriter->combination({0, hardware, storeType, pattern.size, pattern.count,
+                                                     pattern.dataType, pattern.sizeDistribution, pattern.memoryBudget,
+                                                     pattern.keyFormat, pattern.insertionOrder, storeDir.native(),
+                                                     fileSystem.type, fileSystem.options});
+        }
+        if (metricsExporter) {
+            metricsExporter->combination({
+                {"hardware", hardware}, {"store", storeType}, {"data_type", pattern.dataType},
+                {"size_distribution", pattern.sizeDistribution}, {"memory_budget", pattern.memoryBudgetName()},
+                {"key_format", pattern.keyFormat}, {"insertion_order", pattern.insertionOrder},
+                {"size", utils::prettySize(pattern.size.min) + " to " + utils::prettySize(pattern.size.max + 1)},
+                {"records", to_string(pattern.count.min)}, {"file_system", fileSystem.type},
+            }, storeDir / storeType);
+        }
+        auto recordEngineStats = [&](trace::Op op, const std::map<string, double>& stats) {
+            if (sampleWriter) sampleWriter->engineStats(combination, op, stats);
+            return stats;
+        };
+
+        StorePtr store = initStore(storeType, pattern, valueGen);
+
+        store->resetEngineStats();
+        Measurement insert = measure([&]() {
+            if (store->count() >= pattern.count.max) { // on small sizes repeat may be more than size range
+                store.reset(); // close the store first (LevelDB has a lock)
+                store = initStore(storeType, pattern, valueGen);
+            }
+            size_t keyIndex = store->count();
+            string key = genKey(keyIndex);
+            string value = valueGen(pattern.size);
+            auto time = utils::timeIt([&]() { store->insert(key, value); });
+            traceOp(trace::Op::Insert, key, value.size());
+            sampleOp(combination, trace::Op::Insert, keyIndex, value.size(), time);
+            return time;
+        });
+        auto insertEngineStats = recordEngineStats(trace::Op::Insert, store->engineStats());
+
+        store->resetEngineStats();
+        Measurement get = measure([&]() {
+            size_t keyIndex = pickKeyIndex(store);
+            string key = genKey(keyIndex);
+            string value;
+            auto time = utils::timeIt([&]() { value = store->get(key); });
+            traceOp(trace::Op::Get, key);
+            sampleOp(combination, trace::Op::Get, keyIndex, value.size(), time);
+            return time;
+        });
+        auto getEngineStats = recordEngineStats(trace::Op::Get, store->engineStats());
+
+        store->resetEngineStats();
+        Measurement update = measure([&]() {
+            size_t keyIndex = pickKeyIndex(store);
+            string key = genKey(keyIndex);
+            string value = valueGen(pattern.size);
+            auto time = utils::timeIt([&]() { store->update(key, value); });
+            traceOp(trace::Op::Update, key, value.size());
+            sampleOp(combination, trace::Op::Update, keyIndex, value.size(), time);
+            return time;
+        });
+        auto updateEngineStats = recordEngineStats(trace::Op::Update, store->engineStats());
+
+        store->resetEngineStats();
+        Measurement append = measure([&]() {
+            size_t keyIndex = pickKeyIndex(store);
+            string key = genKey(keyIndex);
+            string suffix = valueGen({APPEND_SIZE, APPEND_SIZE});
+            auto time = utils::timeIt([&]() { store->append(key, suffix); });
+            traceOp(trace::Op::Append, key, suffix.size());
+            sampleOp(combination, trace::Op::Append, keyIndex, suffix.size(), time);
+            return time;
+        });
+        auto appendEngineStats = recordEngineStats(trace::Op::Append, store->engineStats());
+
+        store->resetEngineStats();
+        Measurement rmw = measure([&]() {
+            size_t keyIndex = pickKeyIndex(store);
+            string key = genKey(keyIndex);
+            auto time = utils::timeIt([&]() { store->readModifyWrite(key, utils::incrementCounter); });
+            traceOp(trace::Op::ReadModifyWrite, key);
+            sampleOp(combination, trace::Op::ReadModifyWrite, keyIndex, 0, time);
+            return time;
+        });
+        auto rmwEngineStats = recordEngineStats(trace::Op::ReadModifyWrite, store->engineStats());
+
+        store->resetEngineStats();
+        Measurement remove = measure([&]() {
+            size_t keyIndex = pickKeyIndex(store);
+            string key = genKey(keyIndex);
+            auto time = utils::timeIt([&]() { store->remove(key); });
+            traceOp(trace::Op::Remove, key);
+            sampleOp(combination, trace::Op::Remove, keyIndex, 0, time);
+
+            // Put the key back so we don't have to worry about if a key from genKey is still in the Store
+            string value = valueGen(pattern.size);
+            store->insert(key, value);
+            traceOp(trace::Op::Insert, key, value.size());
+            return time;
+        });
+        auto removeEngineStats = recordEngineStats(trace::Op::Remove, store->engineStats());
+
+        long long peakMem = std::max((signed long long) (utils::getPeakMemUsage() - baseMemUsage), 0LL);
+        Stats memoryStats{peakMem};
+
+        path filepath = store->filepath;
+        size_t dataSize = getDataSize(store);
+        store.reset(); // close the store
+
+        size_t diskSize = utils::diskUsage(filepath);
+        int spaceEfficiencyPercent = std::round(((double) dataSize / diskSize) * 100);
+        Stats spaceStats{spaceEfficiencyPercent}; // store as percent
+
+        fs::remove_all(filepath); // Delete the store files
+        if (sampleWriter) {
+            sampleWriter->value(combination, "memory", peakMem);
+            sampleWriter->value(combination, "space", spaceEfficiencyPercent);
+        }
+
+        output << getCSVRow(storeType, "insert", pattern, insert.stats, insertEngineStats, insert.ci);
+        output << getCSVRow(storeType, "update", pattern, update.stats, updateEngineStats, update.ci);
+        output << getCSVRow(storeType, "append", pattern, append.stats, appendEngineStats, append.ci);
+        output << getCSVRow(storeType, "read-modify-write", pattern, rmw.stats, rmwEngineStats, rmw.ci);
+        output << getCSVRow(storeType, "get", pattern, get.stats, getEngineStats, get.ci);
+        output << getCSVRow(storeType, "remove", pattern, remove.stats, removeEngineStats, remove.ci);
+        output << getCSVRow(storeType, "memory", pattern, memoryStats);
+        output << getCSVRow(storeType, "space", pattern, spaceStats);
+        output.flush();
+        return combination;
+    }
+
+    /** The ops `run` measures, in the order it writes their rows */
+    inline static const vector<trace::Op> OP_ORDER{trace::Op::Insert, trace::Op::Update, trace::Op::Append,
+                                                   trace::Op::ReadModifyWrite, trace::Op::Get, trace::Op::Remove};
+
+    /** Everything a samples file has for one combination */
+    struct SampleCell {
+        samples::Combination combination;
+        std::map<trace::Op, vector<long long>> latencies;
+        std::map<trace::Op, std::map<string, double>> engineStats;
+        std::map<string, long long> values;
+    };
 
-                Stats getStats;
-                for (int rep = 0; rep < repeats; rep++) {
-                    string key = pickKey(store);
-                    string value;
-                    auto time = utils::timeIt([&]() { value = store->get(key); });
-                    getStats.record(time.count());
+    /** Reads a samples file recorded during `run`, by combination id */
+    static std::map<uint64_t, SampleCell> readSamples(const path& samplesPath) {
+        std::map<uint64_t, SampleCell> cells;
+        samples::SampleReader reader(samplesPath);
+        samples::Record record;
+        while (reader.next(record)) {
+            switch (record.type) {
+                case samples::Record::Type::Combination:
+                    cells[record.combination.id].combination = record.combination;
+                    break;
+                case samples::Record::Type::Sample:
+                    cells.at(record.sample.combination).latencies[record.sample.op].push_back(
+                        record.sample.latency.count());
+                    break;
+                case samples::Record::Type::EngineStats:
+                    cells.at(record.engineStats.combination).engineStats[record.engineStats.op] =
+                        record.engineStats.stats;
+                    break;
+                case samples::Record::Type::Value:
+                    cells.at(record.value.combination).values[record.value.name] = record.value.value;
+                    break;
+            }
+        }
+        return cells;
+    }
+
+    /**
+     * Aggregates a samples file recorded during `run` back into the CSV `run` writes, with a row for each
+     * combination and op in the same order. The confidence intervals are for the mean at 95%.
+     */
+    static void aggregate(std::ostream& output, const path& samplesPath) {
+        auto cells = readSamples(samplesPath);
+        output << CSV_HEADER;
+        for (auto& [id, cell] : cells) {
+            auto& c = cell.combination;
+            UsagePattern pattern{c.size, c.count, c.dataType, c.sizeDistribution, c.memoryBudget, c.keyFormat,
+                                 c.insertionOrder};
+            for (auto op : OP_ORDER) {
+                if (!cell.latencies.count(op))
+                    continue;
+                Stats stats;
+                stats.recordAll(cell.latencies[op]);
+                auto ci = utils::meanConfidenceInterval(cell.latencies[op], 0.95);
+                output << getCSVRow(c.hardware, c.fileSystem, c.mountOptions, c.store, trace::opName(op), pattern,
+                                    stats, cell.engineStats[op], ci);
+            }
+            for (auto name : {"memory", "space"}) {
+                if (cell.values.count(name)) {
+                    output << getCSVRow(c.hardware, c.fileSystem, c.mountOptions, c.store, name, pattern,
+                                        Stats{cell.values[name]});
                 }
+            }
+        }
+    }
+
+    inline static const string COMPARE_CSV_HEADER = "hardware,store,op,size,records,data type,size distribution,"
+        "memory budget,key format,insertion order,baseline samples,samples,baseline p50,p50,change,u,z,p value,"
+        "verdict\n";
+
+    /**
+     * Reruns the combinations of a samples file recorded during `run` (the baseline) and compares each op's
+     * latencies to the baseline's with a Mann-Whitney U test. A difference is a "regression" or "improvement" if it
+     * is significant at `options.alpha` and the median changed by more than `options.threshold`, otherwise it's
+     * "same". Writes a CSV row per combination and op to output, and the rerun's usual rows to runOutput. Skips
+     * combinations whose data type or size distribution isn't loaded. Returns the number of regressions.
+     */
+    size_t compare(std::ostream& output, std::ostream& runOutput, const path& baselinePath,
+                   const CompareOptions& options) {
+        auto baseline = readSamples(baselinePath);
+
+        // Rerun into a samples file of our own, so the new latencies can be read back the same way as the baseline
+        auto previousWriter = sampleWriter;
+        sampleWriter = std::make_shared<samples::SampleWriter>(options.samplesPath);
+        runOutput << CSV_HEADER;
+        utils::resetPeakMemUsage();
+        size_t baseMemUsage = utils::getPeakMemUsage();
+
+        auto selected = [](auto& list, auto& value) {
+            return list.empty() || std::find(list.begin(), list.end(), value) != list.end();
+        };
+        std::map<uint64_t, uint64_t> rerunIds; // baseline id to rerun id
+        for (auto& [id, cell] : baseline) {
+            auto& c = cell.combination;
+            if (!selected(options.stores, c.store) || !selected(options.records, c.count.min))
+                continue;
+            auto dataGen = std::find_if(dataTypes.begin(), dataTypes.end(),
+                                        [&](auto& dataType) { return dataType.first == c.dataType; });
+            auto sizeDist = std::find_if(sizeDistributions.begin(), sizeDistributions.end(),
+                                         [&](auto& dist) { return dist.first == c.sizeDistribution; });
+            if (dataGen == dataTypes.end() || sizeDist == sizeDistributions.end()) {
+                std::cout << "Skipping " << c.store << ", " << c.dataType << ", " << c.sizeDistribution
+                          << " as it isn't loaded, see --size-distributions\n";
+                continue;
+            }
+            if (c.fileSystem != fileSystem.type) {
+                std::cout << "Note: the baseline ran " << c.store << " on " << c.fileSystem << " but this is "
+                          << fileSystem.type << "\n";
+            }
 
-                Stats updateStats;
-                for (int rep = 0; rep < repeats; rep++) {
-                    string key = pickKey(store);
-                    string value = dataGen(sizeRange);
-                    auto time = utils::timeIt([&]() { store->update(key, value); });
-                    updateStats.record(time.count());
+            UsagePattern pattern{c.size, c.count, c.dataType, c.sizeDistribution, c.memoryBudget, c.keyFormat,
+                                 c.insertionOrder};
+            rerunIds[id] = runCombination(runOutput, baseMemUsage, c.store, pattern,
+                                          makeValueGenerator(dataGen->second, sizeDist->second));
+        }
+        sampleWriter.reset(); // flushes the file
+        sampleWriter = previousWriter;
+        auto rerun = readSamples(options.samplesPath);
+
+        output << COMPARE_CSV_HEADER;
+        size_t regressions = 0;
+        for (auto& [baselineId, rerunId] : rerunIds) {
+            auto& before = baseline.at(baselineId);
+            auto& after = rerun.at(rerunId);
+            auto& c = before.combination;
+            UsagePattern pattern{c.size, c.count, c.dataType, c.sizeDistribution, c.memoryBudget, c.keyFormat,
+                                 c.insertionOrder};
+            for (auto op : OP_ORDER) {
+                if (!before.latencies.count(op) || !after.latencies.count(op))
+                    continue;
+                auto& beforeLatencies = before.latencies[op];
+                auto& afterLatencies = after.latencies[op];
+                auto test = utils::mannWhitneyU(afterLatencies, beforeLatencies);
+                double beforeMedian = utils::percentile(beforeLatencies, 50);
+                double afterMedian = utils::percentile(afterLatencies, 50);
+                double change = beforeMedian > 0 ? afterMedian / beforeMedian - 1 : 0;
+
+                string verdict = "same";
+                if (test.p < options.alpha && change > options.threshold) {
+                    verdict = "regression";
+                    regressions++;
+                    std::cout << "Regression: " << c.store << " " << trace::opName(op) << ", "
+                              << utils::prettySize(c.size.min) << " to " << utils::prettySize(c.size.max + 1) << ", "
+                              << c.count.min << " records: median " << utils::formatNumber(beforeMedian) << "ns to "
+                              << utils::formatNumber(afterMedian) << "ns (p = " << test.p << ")\n";
+                } else if (test.p < options.alpha && change < -options.threshold) {
+                    verdict = "improvement";
                 }
 
-                Stats removeStats;
-                for (int rep = 0; rep < repeats; rep++) {
-                    string key = pickKey(store);
-                    auto time = utils::timeIt([&]() { store->remove(key); });
-                    removeStats.record(time.count());
+                output << hardware << "," << c.store << "," << trace::opName(op) << "," <<
+                    utils::prettySize(c.size.min) << " to " << utils::prettySize(c.size.max + 1) << "," <<
+                    c.count.min << "," << c.dataType << "," << c.sizeDistribution << "," <<
+                    pattern.memoryBudgetName() << "," << c.keyFormat << "," << c.insertionOrder << "," <<
+                    beforeLatencies.size() << "," << afterLatencies.size() << "," <<
+                    utils::formatNumber(beforeMedian) << "," << utils::formatNumber(afterMedian) << "," <<
+                    utils::formatNumber(change) << "," << utils::formatNumber(test.u) << "," <<
+                    utils::formatNumber(test.z) << "," << test.p << "," << verdict << "\n";
+            }
+        }
+        output.flush();
+        return regressions;
+    }
+    inline static const string CHURN_CSV_HEADER = "hardware,store,size,records,data type,size distribution,"
+        "memory budget,second,"
+        "ops,inserts,updates,removes,gets,avg,p50,p99,max,live records,data size,disk usage\n";
+
+    /**
+     * Runs a long, mixed insert/update/remove/get workload against a single store so that effects like compaction
+     * debt, page splits, and fragmentation have time to develop. Writes a CSV timeseries with a row per second of
+     * throughput and latency. Disk usage is filled in every `options.spaceInterval` seconds. Doesn't write the
+     * header, so multiple stores can be written to the same output.
+     */
+    void churn(std::ostream& output, const string& storeType, const UsagePattern& pattern, ValueGenerator valueGen,
+               const ChurnOptions& options) {
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+
+        // valueSizes and live, which can double as it grows
+        limitMemory(pattern, pattern.count.min * (sizeof(size_t) + 2 * sizeof(pair<size_t, size_t>)));
+        vector<size_t> valueSizes;
+        StorePtr store = initStore(storeType, pattern, valueGen, &valueSizes);
+
+        // We remove keys at random, so the keys in the store aren't 0 to count() anymore. Keep track of which are
+        // live (and their sizes so we can calculate space amplification)
+        vector<pair<size_t, size_t>> live;
+        size_t dataSize = 0;
+        for (size_t i = 0; i < valueSizes.size(); i++) {
+            live.push_back({i, valueSizes[i]});
+            dataSize += valueSizes[i];
+        }
+        size_t nextKey = live.size();
+
+        const vector<string> ops{"insert", "update", "remove", "get"};
+        vector<double> weights;
+        for (auto& op : ops)
+            weights.push_back(options.mix.count(op) ? options.mix.at(op) : 0);
+        std::discrete_distribution<size_t> pickOp(weights.begin(), weights.end());
+
+        auto start = chrono::steady_clock::now();
+        chrono::nanoseconds paused{0};
+        auto elapsed = [&]() { return chrono::steady_clock::now() - start - paused; };
+
+        long long second = 0;
+        vector<long long> latencies;
+        std::map<string, size_t> opCounts;
+        auto writeRow = [&]() {
+            string row = hardware + "," + storeType + "," +
+                utils::prettySize(pattern.size.min) + " to " + utils::prettySize(pattern.size.max + 1) + "," +
+                to_string(pattern.count.min) + "," + pattern.dataType + "," + pattern.sizeDistribution + "," +
+                pattern.memoryBudgetName() + "," +
+                to_string(second) + "," +
+                to_string(latencies.size());
+            for (auto& op : ops)
+                row += "," + to_string(opCounts[op]);
+            if (latencies.empty()) {
+                row += ",,,,";
+            } else {
+                Stats stats; stats.recordAll(latencies);
+                row += "," + to_string(stats.avg()) + "," + to_string(utils::percentile(latencies, 50)) + "," +
+                    to_string(utils::percentile(latencies, 99)) + "," + to_string(stats.max());
+            }
+            row += "," + to_string(live.size()) + "," + to_string(dataSize) + ",";
+
+            auto interval = options.spaceInterval.count();
+            if (interval > 0 && second % interval == 0) {
+                auto time = utils::timeIt([&]() { row += to_string(utils::diskUsage(store->filepath)); });
+                paused += time;
+            }
+            output << row << "\n";
+            output.flush();
+
+            latencies.clear();
+            opCounts.clear();
+        };
+
+        size_t opCount = 0;
+        while (elapsed() < options.duration && (options.maxOps == 0 || opCount < options.maxOps)) {
+            while (elapsed() >= chrono::seconds(second + 1)) { // a stall could last more than one bucket
+                writeRow();
+                second++;
+            }
+
+            string op = ops[pickOp(utils::randGen)];
+            if (live.empty()) op = "insert";
+            size_t liveI = live.empty() ? 0 : utils::randInt<size_t>(0, live.size() - 1);
+
+            chrono::nanoseconds time;
+            if (op == "insert") {
+                string key = genKey(nextKey);
+                string value = valueGen(pattern.size);
+                time = utils::timeIt([&]() { store->insert(key, value); });
+                traceOp(trace::Op::Insert, key, value.size());
+                live.push_back({nextKey++, value.size()});
+                dataSize += value.size();
+            } else if (op == "update") {
+                string key = genKey(live[liveI].first);
+                string value = valueGen(pattern.size);
+                time = utils::timeIt([&]() { store->update(key, value); });
+                traceOp(trace::Op::Update, key, value.size());
+                dataSize = dataSize - live[liveI].second + value.size();
+                live[liveI].second = value.size();
+            } else if (op == "remove") {
+                string key = genKey(live[liveI].first);
+                time = utils::timeIt([&]() { store->remove(key); });
+                traceOp(trace::Op::Remove, key);
+                dataSize -= live[liveI].second;
+                live[liveI] = live.back();
+                live.pop_back();
+            } else {
+                string key = genKey(live[liveI].first);
+                string value;
+                time = utils::timeIt([&]() { value = store->get(key); });
+                traceOp(trace::Op::Get, key);
+            }
+            latencies.push_back(time.count());
+            opCounts[op]++;
+            opCount++;
+        }
+        writeRow();
+
+        store.reset();
+        fs::remove_all(storeDir / storeType);
+    }
+    inline static const string EXPIRE_CSV_HEADER = "hardware,store,size,records,data type,size distribution,"
+        "memory budget,method,batch,keys,seconds,keys/s,disk before,disk after,reclaimed\n";
+
+    /**
+     * Fills a store and then deletes from it in `options.batches` bulk deletes, like expiring old data. Writes a CSV
+     * row per batch with the delete throughput and how much disk space it reclaimed. Disk usage is measured with the
+     * store open, so engines that only reclaim space on compaction show that. Doesn't write the header.
+     */
+    void expire(std::ostream& output, const string& storeType, const UsagePattern& pattern, ValueGenerator valueGen,
+                const ExpireOptions& options) {
+        if (options.method != "range" && options.method != "keys")
+            throw std::runtime_error("Unknown expire method " + options.method);
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+
+        limitMemory(pattern, pattern.count.min * 128); // live and the batch, a key is at most ~100 bytes as a string
+        StorePtr store = initStore(storeType, pattern, valueGen);
+
+        vector<string> live;
+        for (size_t i = 0; i < store->count(); i++)
+            live.push_back(genKey(i));
+        std::sort(live.begin(), live.end()); // ranges are in key order
+        size_t batchSize = std::max<size_t>(std::round(pattern.count.min * options.fraction), 1);
+
+        for (size_t batch = 0; batch < options.batches && !live.empty(); batch++) {
+            size_t n = std::min(batchSize, live.size());
+            vector<string> keys;
+            if (options.method == "range") {
+                auto first = live.begin() + utils::randInt<size_t>(0, live.size() - n);
+                keys.assign(first, first + n);
+                live.erase(first, first + n);
+            } else {
+                std::shuffle(live.begin(), live.end(), utils::randGen);
+                keys.assign(live.end() - n, live.end());
+                live.resize(live.size() - n);
+                std::sort(live.begin(), live.end());
+                std::sort(keys.begin(), keys.end());
+            }
+
+            size_t diskBefore = utils::diskUsage(store->filepath);
+            auto time = utils::timeIt([&]() {
+                if (options.method == "range")
+                    store->removeRange(keys);
+                else
+                    store->bulkRemove(keys);
+            });
+            size_t diskAfter = utils::diskUsage(store->filepath);
+            for (auto& key : keys)
+                traceOp(trace::Op::Remove, key);
+
+            double seconds = chrono::duration<double>(time).count();
+            output << hardware << "," << storeType << "," <<
+                utils::prettySize(pattern.size.min) << " to " << utils::prettySize(pattern.size.max + 1) << "," <<
+                pattern.count.min << "," << pattern.dataType << "," << pattern.sizeDistribution << "," <<
+                pattern.memoryBudgetName() << "," << options.method << "," << batch << "," << n << "," <<
+                seconds << "," << (n / seconds) << "," << diskBefore << "," << diskAfter << "," <<
+                ((long long) diskBefore - (long long) diskAfter) << "\n";
+            output.flush();
+        }
+
+        store.reset();
+        fs::remove_all(storeDir / storeType);
+    }
+    inline static const string OPEN_LOOP_CSV_HEADER = "hardware,store,size,records,data type,size distribution,"
+        "memory budget,arrival,target rate,"
+        "achieved rate,ops,p50,p90,p99,p99.9,max,uncorrected p50,uncorrected p99,saturated\n";
+
+    /**
+     * Runs an open-loop workload against a single store. Ops are issued on a fixed or Poisson schedule at each
+     * target rate in `options.rates`, regardless of whether earlier ops have finished. Latency is measured from the
+     * time each op was scheduled to start, so a stall also counts against all the ops queued up behind it (avoiding
+     * "coordinated omission"). Stops the sweep after the first saturated rate. Returns the highest target rate that
+     * wasn't saturated, or 0 if all were.
+     */
+    double openLoop(std::ostream& output, const string& storeType, const UsagePattern& pattern, ValueGenerator valueGen,
+                    const OpenLoopOptions& options) {
+        if (options.arrival != "poisson" && options.arrival != "fixed")
+            throw std::runtime_error("Unknown arrival process " + options.arrival + ", expected poisson or fixed");
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+
+        // Generating large values can take longer than the op itself, so use a pool to keep the driver's overhead
+        // from delaying the schedule. Generate it before limiting memory so it doesn't count against the budget.
+        vector<string> values;
+        for (int i = 0; i < 100; i++)
+            values.push_back(valueGen(pattern.size));
+
+        limitMemory(pattern);
+        StorePtr store = initStore(storeType, pattern, valueGen);
+
+        const vector<string> ops{"insert", "update", "get"};
+        vector<double> weights;
+        for (auto& op : ops)
+            weights.push_back(options.mix.count(op) ? options.mix.at(op) : 0);
+        std::discrete_distribution<size_t> pickOp(weights.begin(), weights.end());
 
-                    // Put the key back so we don't have to worry about if a key from genKey is still in the Store
-                    string value = dataGen(sizeRange);
+        double maxUnsaturated = 0;
+        for (double rate : options.rates) {
+            std::exponential_distribution<double> poissonGap(rate);
+            auto nextGap = [&]() {
+                double seconds = options.arrival == "poisson" ? poissonGap(utils::randGen) : 1 / rate;
+                return chrono::duration_cast<chrono::nanoseconds>(chrono::duration<double>(seconds));
+            };
+
+            vector<long long> corrected, uncorrected;
+            auto start = chrono::steady_clock::now();
+            auto stop = start + options.duration;
+            auto intended = start;
+            auto end = start;
+            for (size_t i = 0; intended < stop; i++, intended += nextGap()) {
+                string op = ops[pickOp(utils::randGen)];
+                string key = op == "insert" ? genKey(store->count()) : pickKey(store);
+                const string& value = values[i % values.size()];
+
+                // Sleep most of the way and then spin, sleep_until alone is too coarse for high rates
+                while (chrono::steady_clock::now() < intended) {
+                    if (intended - chrono::steady_clock::now() > chrono::microseconds(100))
+                        std::this_thread::sleep_until(intended - chrono::microseconds(50));
+                }
+
+                auto actualStart = chrono::steady_clock::now();
+                if (op == "insert") {
                     store->insert(key, value);
+                } else if (op == "update") {
+                    store->update(key, value);
+                } else {
+                    string result = store->get(key);
                 }
+                end = chrono::steady_clock::now();
+                if (op == "get")
+                    traceOp(trace::Op::Get, key);
+                else
+                    traceOp(op == "insert" ? trace::Op::Insert : trace::Op::Update, key, value.size());
+
+                corrected.push_back(chrono::duration_cast<chrono::nanoseconds>(end - intended).count());
+                uncorrected.push_back(chrono::duration_cast<chrono::nanoseconds>(end - actualStart).count());
 
-                long long peakMem = std::max((signed long long) (utils::getPeakMemUsage() - baseMemUsage), 0LL);
-                Stats memoryStats{peakMem};
+                if (end > stop + options.duration) break; // Far behind schedule, no need to work through the backlog
+            }
 
-                path filepath = store->filepath;
-                size_t dataSize = getDataSize(store);
-                store.reset(); // close the store
+            double achieved = corrected.size() / chrono::duration<double>(end - start).count();
+            bool saturated = achieved < options.saturationThreshold * rate;
+            Stats stats; stats.recordAll(corrected);
 
-                size_t diskSize = utils::diskUsage(filepath);
-                int spaceEfficiencyPercent = std::round(((double) dataSize / diskSize) * 100);
-                Stats spaceStats{spaceEfficiencyPercent}; // store as percent
+            output << hardware << "," << storeType << "," <<
+                utils::prettySize(pattern.size.min) << " to " << utils::prettySize(pattern.size.max + 1) << "," <<
+                pattern.count.min << "," << pattern.dataType << "," << pattern.sizeDistribution << "," <<
+                pattern.memoryBudgetName() << "," << options.arrival << "," <<
+                utils::formatNumber(rate) << "," << utils::formatNumber(achieved) << "," << corrected.size() << "," <<
+                utils::percentile(corrected, 50) << "," << utils::percentile(corrected, 90) << "," <<
+                utils::percentile(corrected, 99) << "," << utils::percentile(corrected, 99.9) << "," <<
+                stats.max() << "," <<
+                utils::percentile(uncorrected, 50) << "," << utils::percentile(uncorrected, 99) << "," <<
+                (saturated ? "true" : "false") << "\n";
+            output.flush();
 
-                fs::remove_all(filepath); // Delete the store files
+            if (saturated) break;
+            maxUnsaturated = rate;
+        }
 
-                output << getCSVRow(storeType, "insert", pattern, insertStats);
-                output << getCSVRow(storeType, "update", pattern, updateStats);
-                output << getCSVRow(storeType, "get", pattern, getStats);
-                output << getCSVRow(storeType, "remove", pattern, removeStats);
-                output << getCSVRow(storeType, "memory", pattern, memoryStats);
-                output << getCSVRow(storeType, "space", pattern, spaceStats);
-                output.flush();
+        store.reset();
+        fs::remove_all(storeDir / storeType);
+        return maxUnsaturated;
+    }
+    inline static const string REPLAY_CSV_HEADER = "hardware,store,op,trace,threads,timing,"
+        "memory budget,measurements,sum,min,max,avg,errors,elapsed\n";
+
+    /** Replays a trace against a new, empty store and writes a CSV row of latency stats for each op type. */
+    void replay(std::ostream& output, const string& storeType, const path& tracePath, const UsagePattern& pattern,
+                DataGenerator dataGen, const trace::ReplayOptions& options) {
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+        limitMemory(pattern);
+        StorePtr store = storeFactory(storeType, storeDir / storeType, pattern);
+
+        trace::ReplayResult result = trace::replay(*store, tracePath, dataGen, options);
+
+        for (auto& [op, stats] : result.stats) {
+            output << hardware << "," << storeType << "," << trace::opName(op) << "," <<
+                tracePath.filename().native() << "," << options.threads << "," <<
+                (options.originalTiming ? "original" : "fast") << "," << pattern.memoryBudgetName() << "," <<
+                stats.count() << "," << stats.sum() << "," << stats.min() << "," << stats.max() << "," <<
+                stats.avg() << "," << result.errors << "," << result.elapsed.count() << "\n";
+        }
+        output.flush();
+
+        store.reset();
+        fs::remove_all(storeDir / storeType);
+    }
+    inline static const string READ_SCALING_CSV_HEADER = "hardware,store,size,records,data type,memory budget,readers,"
+        "writer,seconds,reads,reads/s,read p50,read p99,read max,writes,writes/s,write p50,write p99\n";
+
+    /**
+     * Measures how reads scale with the number of threads: gets random records from each of `options.readers`
+     * threads for `options.duration`, while another thread updates random records if `options.writer` is set.
+     * Stores that aren't `threadSafe` are locked around each op. Writes a CSV row per number of readers. Doesn't
+     * write the header.
+     */
+    void readScaling(std::ostream& output, const string& storeType, const UsagePattern& pattern,
+                     ValueGenerator valueGen, const ReadScalingOptions& options) {
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+        vector<string> values; // generate the writer's values up front, as in openLoop
+        for (int i = 0; i < 100; i++)
+            values.push_back(valueGen(pattern.size));
+
+        limitMemory(pattern);
+        StorePtr store = initStore(storeType, pattern, valueGen);
+        size_t count = store->count(); // updates don't change it
+
+        std::mutex storeMutex;
+        auto lockStore = [&]() {
+            std::unique_lock<std::mutex> lock(storeMutex, std::defer_lock);
+            if (!store->threadSafe()) lock.lock();
+            return lock;
+        };
+
+        for (unsigned readers : options.readers) {
+            std::atomic<bool> stop = false;
+            vector<vector<long long>> readTimes(readers);
+            vector<long long> writeTimes;
+            // utils::randGen isn't thread safe, so each thread gets its own generator seeded from it
+            auto makeRandKey = [&]() {
+                std::mt19937_64 gen(utils::randGen());
+                return [this, gen, pick = std::uniform_int_distribution<size_t>(0, count - 1)]() mutable {
+                    return genKey(pick(gen));
+                };
+            };
+
+            vector<std::thread> threads;
+            auto start = chrono::steady_clock::now();
+            if (options.writer) {
+                threads.emplace_back([&, randKey = makeRandKey()]() mutable {
+                    for (size_t i = 0; !stop; i++) {
+                        string key = randKey();
+                        auto lock = lockStore();
+                        writeTimes.push_back(utils::timeIt([&]() { store->update(key, values[i % values.size()]); })
+                                             .count());
+                    }
+                });
             }
+            for (unsigned t = 0; t < readers; t++) {
+                threads.emplace_back([&, t, randKey = makeRandKey()]() mutable {
+                    while (!stop) {
+                        string key = randKey();
+                        string value;
+                        auto lock = lockStore();
+                        readTimes[t].push_back(utils::timeIt([&]() { value = store->get(key); }).count());
+                    }
+                });
+            }
+            std::this_thread::sleep_for(options.duration);
+            stop = true;
+            for (auto& thread : threads)
+                thread.join();
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            vector<long long> reads;
+            for (auto& times : readTimes)
+                reads.insert(reads.end(), times.begin(), times.end());
+            Stats readStats;
+            readStats.recordAll(reads);
+            auto percentile = [](vector<long long>& times, double p) {
+                return times.empty() ? "" : to_string(utils::percentile(times, p));
+            };
+
+            output << hardware << "," << storeType << "," <<
+                utils::prettySize(pattern.size.min) << " to " << utils::prettySize(pattern.size.max + 1) << "," <<
+                pattern.count.min << "," << pattern.dataType << "," << pattern.memoryBudgetName() << "," <<
+                readers << "," << (options.writer ? "true" : "false") << "," << seconds << "," <<
+                reads.size() << "," << utils::formatNumber(reads.size() / seconds) << "," <<
+                percentile(reads, 50) << "," << percentile(reads, 99) << "," << readStats.max() << "," <<
+                writeTimes.size() << "," << utils::formatNumber(writeTimes.size() / seconds) << "," <<
+                percentile(writeTimes, 50) << "," << percentile(writeTimes, 99) << "\n";
+            output.flush();
+            std::cout << storeType << " with " << readers << " readers: "
+                      << utils::formatNumber(reads.size() / seconds) << " reads/s\n";
         }
+
+        store.reset();
+        fs::remove_all(storeDir / storeType);
+    }
+
+    inline static const string OVERHEAD_CSV_HEADER = "hardware,store,op,size,records,data type,key format,samples,"
+        "harness avg,direct avg,harness p50,direct p50,harness p99,direct p99,overhead p50,overhead percent\n";
+
+    /**
+     * Measures how much of each op is the benchmark harness rather than the store. Times get and update the way
+     * `run` does, through the virtual `Store` interface and `utils::timeIt`'s `std::function`, and through a direct,
+     * non-virtual call to the concrete store type S with `utils::timeInline`. The two are interleaved so drift like
+     * compactions affects both equally, but use different random keys so neither gets the other's cache hits. Doesn't
+     * write the header.
+     */
+    template<typename S>
+    void measureOverhead(std::ostream& output, const string& storeType, const UsagePattern& pattern, Store& store,
+                         S& direct, ValueGenerator valueGen) {
+        // Pick the keys and values up front so neither path times generating them
+        vector<string> keys, values;
+        for (int i = 0; i < repeats * 2; i++) { // even for the harness, odd for direct calls
+            keys.push_back(genKey(utils::randInt<size_t>(0, pattern.count.min - 1)));
+            values.push_back(valueGen(pattern.size));
+        }
+
+        std::map<string, pair<vector<long long>, vector<long long>>> times; // op: {harness, direct}
+        for (int i = 0; i < repeats * 2; i += 2) {
+            string value;
+            times["get"].first.push_back(utils::timeIt([&]() { value = store.get(keys[i]); }).count());
+            times["get"].second.push_back(utils::timeInline([&]() { value = direct.S::_get(keys[i + 1]); }).count());
+        }
+        for (int i = 0; i < repeats * 2; i += 2) {
+            times["update"].first.push_back(utils::timeIt([&]() { store.update(keys[i], values[i]); }).count());
+            times["update"].second.push_back(utils::timeInline([&]() {
+                direct.S::_update(keys[i + 1], values[i + 1]);
+            }).count());
+        }
+
+        for (auto& [op, opTimes] : times) {
+            auto& [harness, directTimes] = opTimes;
+            Stats harnessStats, directStats;
+            harnessStats.recordAll(harness);
+            directStats.recordAll(directTimes);
+            long long harnessP50 = utils::percentile(harness, 50), directP50 = utils::percentile(directTimes, 50);
+            output << hardware << "," << storeType << "," << op << "," <<
+                utils::prettySize(pattern.size.min) << " to " << utils::prettySize(pattern.size.max + 1) << "," <<
+                pattern.count.min << "," << pattern.dataType << "," << pattern.keyFormat << "," << repeats << "," <<
+                harnessStats.avg() << "," << directStats.avg() << "," << harnessP50 << "," << directP50 << "," <<
+                utils::percentile(harness, 99) << "," << utils::percentile(directTimes, 99) << "," <<
+                (harnessP50 - directP50) << "," <<
+                utils::formatNumber(100.0 * (harnessP50 - directP50) / std::max(harnessP50, 1LL)) << "\n";
+        }
+        output.flush();
+    }
+
+    /** Runs `measureOverhead` with whichever of Types store is exactly. Returns false if it's none of them. */
+    template<typename... Types>
+    bool measureOverheadAny(std::ostream& output, const string& storeType, const UsagePattern& pattern, Store& store,
+                            ValueGenerator valueGen) {
+        // Not dynamic_cast, a subclass (e.g. NestedFolderFdStore) would be called with its parent's methods
+        auto measureIf = [&](auto* type) {
+            using S = std::remove_pointer_t<decltype(type)>;
+            if (typeid(store) != typeid(S))
+                return false;
+            measureOverhead(output, storeType, pattern, store, static_cast<S&>(store), valueGen);
+            return true;
+        };
+        return (measureIf((Types*) nullptr) || ...);
+    }
+
+    /** Creates a store with pattern.count.min records and runs `measureOverhead` with its concrete type */
+    void overhead(std::ostream& output, const string& storeType, const UsagePattern& pattern,
+                  ValueGenerator valueGen) {
+        fs::remove_all(storeDir);
+        fs::create_directories(storeDir);
+        limitMemory(pattern);
+        StorePtr store = initStore(storeType, pattern, valueGen);
+
+        bool measured = measureOverheadAny<
+            stores::MemoryStore, stores::SQLite3Store, stores::SQLite3PoolStore, stores::LevelDBStore,
+            stores::RocksDBStore, stores::BerkeleyDBStore, stores::FlatFolderStore, stores::NestedFolderStore,
+            stores::NestedFolderFdStore, stores::ReshardingFolderStore, stores::PosixFileStore, stores::HybridStore
+        >(output, storeType, pattern, *store, valueGen);
+        if (!measured)
+            throw std::runtime_error("Can't call " + storeType + " directly, its type isn't in `Benchmark::overhead`");
+
+        store.reset();
+        fs::remove_all(storeDir / storeType);
     }
 };
 
 
+/** Records at least this big are stored as files by the hybrid stores, and as blob files by "RocksDBBlob" */
+const size_t HYBRID_THRESHOLD = 64 * KiB;
+/** Cache size of the "BerkeleyDBEnv" stores */
+const size_t BERKELEYDB_CACHE_SIZE = 256 * MiB;
+/** Target number of files per directory for "NestedFolderAuto" and "NestedFolderResharding" */
+const size_t FILES_PER_DIR = 256;
+
+/**
+ * Creates a store. If pattern has a memory budget, it's split between the engine's caches and write buffers:
+ * - SQLite3: all of it as the page cache
+ * - SQLite3Pool: all of it as the page cache of each connection, as the number of threads isn't known up front
+ * - LevelDB: half as the block cache, and a quarter for each of the active and immutable memtables
+ * - RocksDB: all of it as a block cache that index and filter blocks and memtables (through a WriteBufferManager)
+ *   are charged to as well
+ * - BerkeleyDB: all of it as the memory pool
+ * - The file stores only have the kernel page cache, which is only limited with `Benchmark::memoryCgroup`
+ */
 StorePtr storeFactory(string storeType, path filepath, const UsagePattern& pattern) {
+    size_t budget = pattern.memoryBudget;
     if (storeType == "SQLite3") {
-        return make_unique<stores::SQLite3Store>(filepath);
+        return make_unique<stores::SQLite3Store>(filepath, 0, budget);
+    } else if (storeType == "SQLite3Pool") {
+        return make_unique<stores::SQLite3PoolStore>(filepath, budget);
     } else if (storeType == "LevelDB") {
         leveldb::Options options;
         options.compression = (pattern.dataType == "compressible") ?
             leveldb::CompressionType::kSnappyCompression :
             leveldb::CompressionType::kNoCompression;
-        return make_unique<stores::LevelDBStore>(filepath);
-    } else if (storeType == "RocksDB") {
+        if (budget > 0)
+            options.write_buffer_size = budget / 4;
+        return make_unique<stores::LevelDBStore>(filepath, options, budget / 2);
+    } else if (storeType == "RocksDB" || storeType == "RocksDBBlob") {
         rocksdb::Options options;
         options.compression = (pattern.dataType == "compressible") ?
             rocksdb::CompressionType::kSnappyCompression :
             rocksdb::CompressionType::kNoCompression;
-        return make_unique<stores::RocksDBStore>(filepath);
+        if (storeType == "RocksDBBlob") {
+            // Integrated BlobDB keeps large values in separate blob files with a reference in the LSM tree, like
+            // HybridStore. Use the same threshold so they're comparable.
+            options.enable_blob_files = true;
+            options.min_blob_size = HYBRID_THRESHOLD;
+            options.blob_compression_type = options.compression;
+            options.enable_blob_garbage_collection = true;
+        }
+        if (budget > 0) {
+            rocksdb::BlockBasedTableOptions tableOptions;
+            tableOptions.block_cache = rocksdb::NewLRUCache(budget);
+            tableOptions.cache_index_and_filter_blocks = true;
+            options.table_factory.reset(rocksdb::NewBlockBasedTableFactory(tableOptions));
+            options.write_buffer_manager = std::make_shared<rocksdb::WriteBufferManager>(budget / 2,
+                                                                                         tableOptions.block_cache);
+            options.write_buffer_size = budget / 4;
+        }
+        return make_unique<stores::RocksDBStore>(filepath, options);
     } else if (storeType == "BerkeleyDB") {
-        return make_unique<stores::BerkeleyDBStore>(filepath);
+        return make_unique<stores::BerkeleyDBStore>(filepath, DB_BTREE, 0, budget);
+    } else if (storeType.rfind("BerkeleyDBEnv", 0) == 0) {
+        // "BerkeleyDBEnv" is a B-tree in a DbEnv with a sized cache. Suffixes pick variants: "Hash" for the hash
+        // access method, "Txn" for transactions, and "Thread" for DB_THREAD, e.g. "BerkeleyDBEnvHashTxn".
+        string variant = storeType.substr("BerkeleyDBEnv"s.size());
+        auto take = [&](const string& option) {
+            size_t pos = variant.find(option);
+            if (pos == string::npos) return false;
+            variant.erase(pos, option.size());
+            return true;
+        };
+        stores::BerkeleyDBEnvOptions options;
+        options.cacheSize = budget > 0 ? budget : BERKELEYDB_CACHE_SIZE;
+        // Bigger pages keep bigger records out of overflow pages
+        options.pageSize = pattern.size.max >= 1 * KiB ? 64 * KiB : 0;
+        options.transactional = take("Txn");
+        options.threaded = take("Thread");
+        DBTYPE dbtype = take("Hash") ? DB_HASH : DB_BTREE;
+        if (!variant.empty())
+            throw std::runtime_error("Unknown store type "s + storeType);
+        return make_unique<stores::BerkeleyDBStore>(filepath, options, dbtype);
     } else if (storeType == "FlatFolder") {
         return make_unique<stores::FlatFolderStore>(filepath);
     } else if (storeType == "NestedFolder") {
@@ -232,12 +1374,228 @@ StorePtr storeFactory(string storeType, path filepath, const UsagePattern& patte
         // 3 levels of nesting with 2 chars and a max of 10,000,000 records should have 2 levels with 265
         // folders and and about 142 files at the lowest level on average.
         return make_unique<stores::NestedFolderStore>(filepath, 2, 3, 32);
+    } else if (storeType == "NestedFolderFd") {
+        return make_unique<stores::NestedFolderFdStore>(filepath, 2, 3, 32);
+    } else if (storeType == "NestedFolderAuto") {
+        // Picks the layout from the expected number of records instead of the fixed 3 levels of 2 chars
+        auto [charsPerLevel, depth] = stores::NestedFolderStore::autoLayout(pattern.count.max, FILES_PER_DIR, 32);
+        return make_unique<stores::NestedFolderStore>(filepath, charsPerLevel, depth, 32);
+    } else if (storeType == "NestedFolderResharding") {
+        return make_unique<stores::ReshardingFolderStore>(filepath, 2, FILES_PER_DIR, 32);
+    } else if (storeType == "PosixFile") {
+        return make_unique<stores::PosixFileStore>(filepath);
+    } else if (storeType == "PosixFileDirect") {
+        return make_unique<stores::PosixFileStore>(filepath, true, true, 64 * KiB);
+    } else if (storeType == "Memory") {
+        return make_unique<stores::MemoryStore>(filepath);
+    } else if (storeType.rfind("Hybrid", 0) == 0) {
+        // e.g. "HybridSQLite3" keeps small records in SQLite3 and large records in nested folders
+        string dbType = storeType.substr("Hybrid"s.size());
+        auto makeDb = [&](const path& dbPath) { return storeFactory(dbType, dbPath, pattern); };
+        return make_unique<stores::HybridStore>(filepath, makeDb, HYBRID_THRESHOLD);
     } else {
         throw std::runtime_error("Unknown store type "s + storeType);
     }
 }
 
 
+/**
+ * The command line arguments that aren't doctest options. Positional args are things like the mode, and options are
+ * passed as `--name=value`. Doctest options must use its `--dt-` prefix (e.g. `--dt-test-case=...`) so they can be
+ * told apart from misspelt options.
+ */
+struct Args {
+    /** Every option main reads. Add new options here too, anything else is rejected. */
+    inline static const std::set<string> KNOWN_OPTIONS{
+        "alpha", "arrival", "batches", "ci-percentile", "confidence", "cpus", "data-type", "duration", "engine-cpus",
+        "engine-threads", "expire-by", "fraction", "hardware", "insertion-orders", "key-formats", "lognormal-sigma",
+        "max-samples", "max-size", "memory-budgets", "memory-cgroup", "metrics", "metrics-disk-usage",
+        "metrics-interval", "min-samples", "min-size", "mix", "numa-nodes", "ops", "pareto-alpha", "rates", "readers",
+        "record-samples", "record-trace", "records", "saturation", "seed", "size-distributions", "size-histogram",
+        "space-interval", "store-dirs", "stores", "target-error", "threads", "threshold", "time-budget", "timing",
+        "tmpfs-baseline", "warmup", "writer",
+    };
+
+    vector<string> positional;
+    std::map<string, string> options;
+
+    Args(int argc, char** argv) {
+        for (int i = 1; i < argc; i++) {
+            string arg = argv[i];
+            if (arg.rfind("--dt-", 0) == 0) {
+                continue; // for doctest
+            } else if (arg.rfind("--", 0) == 0) {
+                auto eq = arg.find('=');
+                string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+                if (!KNOWN_OPTIONS.count(name))
+                    throw std::runtime_error("Unknown option --" + name);
+                if (eq == string::npos)
+                    throw std::runtime_error("Option --" + name + " needs a value, e.g. --" + name + "=<value>");
+                options[name] = arg.substr(eq + 1);
+            } else if (arg.rfind("-", 0) != 0) {
+                positional.push_back(arg);
+            }
+        }
+    }
+
+    string get(const string& name, const string& fallback) const {
+        return options.count(name) ? options.at(name) : fallback;
+    }
+
+    long long getInt(const string& name, long long fallback) const {
+        return options.count(name) ? std::stoll(options.at(name)) : fallback;
+    }
+
+    /** Parses a comma separated list option */
+    vector<string> getList(const string& name, const vector<string>& fallback) const {
+        if (!options.count(name)) return fallback;
+        vector<string> list;
+        std::stringstream ss(options.at(name));
+        string item;
+        while (std::getline(ss, item, ','))
+            list.push_back(item);
+        return list;
+    }
+};
+
+
+/**
+ * Says which key formats the full benchmark won't run in every insertion order. hex and binary keys are hashes, so
+ * their sequential runs would repeat the random ones under another label and `runCombinations` skips them.
+ */
+void warnUnorderedKeyFormats(const vector<string>& keyFormats, const vector<string>& insertionOrders) {
+    bool hasRandom = std::find(insertionOrders.begin(), insertionOrders.end(), "random") != insertionOrders.end();
+    if (insertionOrders.size() == (hasRandom ? 1 : 0))
+        return;
+    for (auto& keyFormat : keyFormats) {
+        if (utils::KeyGenerator::hasOrder(keyFormat))
+            continue;
+        if (hasRandom)
+            std::cout << "Only running " << keyFormat << " keys in random order, as they're hashes\n";
+        else
+            std::cout << "Skipping " << keyFormat << " keys, as they're hashes and can only be in random order\n";
+    }
+}
+
+
+/** Returns a path like out/benchmarks/benchmark20220101120000.csv for an output file */
+path outputPath(const string& name, const string& extension = ".csv") {
+    const std::time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    std::stringstream nowStr;
+    nowStr << std::put_time(std::localtime(&now), "%Y%m%d%H%M%S");
+    path outFilePath = path("out") / "benchmarks" / (name + nowStr.str() + extension);
+    fs::create_directories(outFilePath.parent_path());
+    return outFilePath;
+}
+
+
+/**
+ * Applies the CPU and NUMA placement options and returns a description of the topology and placement to record
+ * alongside the output:
+ * - `--numa-nodes` binds memory allocations to NUMA nodes. Falls back to the default policy if NUMA isn't available.
+ * - `--engine-cpus` pins RocksDB's background thread pools. The pools are started while the main thread is pinned to
+ *   those CPUs so the threads inherit the affinity. `--engine-threads` sets the size of the compaction pool.
+ * - `--cpus` pins the benchmark thread. Threads created afterwards, like LevelDB's background thread or RocksDB
+ *   threads beyond the started pools, inherit it too.
+ */
+string placeThreads(const Args& args) {
+    vector<string> placement{"topology: " + utils::describeTopology()};
+
+    if (args.options.count("numa-nodes")) {
+        auto nodes = utils::parseCpuList(args.get("numa-nodes", ""));
+        try {
+            utils::bindMemory(nodes);
+            placement.push_back("memory nodes: " + utils::formatCpuList(nodes));
+        } catch (const std::exception& e) {
+            std::cout << "Not binding memory to NUMA nodes: " << e.what() << "\n";
+            placement.push_back("memory nodes: default (" + string(e.what()) + ")");
+        }
+    }
+
+    vector<int> foregroundCpus = utils::threadAffinity();
+    if (args.options.count("cpus"))
+        foregroundCpus = utils::parseCpuList(args.get("cpus", ""));
+    if (args.options.count("engine-cpus")) {
+        auto engineCpus = utils::parseCpuList(args.get("engine-cpus", ""));
+        int threads = args.getInt("engine-threads", std::max<int>(engineCpus.size(), 2));
+        utils::pinThread(engineCpus);
+        rocksdb::Env::Default()->SetBackgroundThreads(threads, rocksdb::Env::Priority::LOW);
+        rocksdb::Env::Default()->SetBackgroundThreads(1, rocksdb::Env::Priority::HIGH);
+        placement.push_back("engine cpus: " + utils::formatCpuList(engineCpus) + " (" + to_string(threads) +
+                            " compaction threads)");
+        utils::pinThread(foregroundCpus);
+    }
+    if (args.options.count("cpus")) {
+        utils::pinThread(foregroundCpus);
+        placement.push_back("foreground cpus: " + utils::formatCpuList(foregroundCpus));
+    }
+    return utils::join(placement, "\n") + "\n";
+}
+
+
+/**
+ * Usage: `benchmark [mode] [--option=value...]`
+ * Modes:
+ * - (none): Runs the full benchmark over every combination of store, data type, size, and count. Each op is run
+ *   `--warmup` times untimed, then sampled 1000 times, or with `--target-error` (e.g. `0.05`) until the
+ *   `--confidence` (default 0.95) interval of the mean, or of the `--ci-percentile`, is within that relative error,
+ *   taking `--min-samples` to `--max-samples` samples for at most `--time-budget` seconds. The CSV records the
+ *   interval achieved.
+ * - churn: Runs a long mixed workload against each of `--stores` and writes a throughput timeseries. Options:
+ *   `--duration` (seconds), `--ops`, `--records`, `--min-size`, `--max-size`, `--data-type`,
+ *   `--mix` (e.g. `insert:1,update:1,remove:1,get:1`), `--space-interval` (seconds).
+ * - expire: Fills each of `--stores` and then deletes from it in `--batches` bulk deletes of `--fraction` of the
+ *   records each, measuring delete throughput and space reclaimed. `--expire-by` is `range` for contiguous key
+ *   ranges or `keys` for randomly picked keys. Also accepts `--records`, `--min-size`, `--max-size`, `--data-type`.
+ * - openloop: Issues ops at fixed target rates against each of `--stores` to find their saturation points, measuring
+ *   latency from each op's intended start time. Options: `--rates` (ops/s, e.g. `1000,2000`), `--duration` (seconds
+ *   per rate), `--arrival` (`poisson` or `fixed`), `--saturation` (fraction of the target rate), `--mix`
+ *   (of insert, update, and get), and `--records`, `--min-size`, `--max-size`, `--data-type` as in churn.
+ * - overhead: Measures how much of get and update is the benchmark harness, by timing them both the usual way and
+ *   with direct, non-virtual calls to each of `--stores` (see `Benchmark::overhead`). Add `Memory` to `--stores` for
+ *   an in-memory baseline. Accepts `--records`, `--min-size`, `--max-size`, `--data-type` as in churn.
+ * - readscaling: Measures how gets scale with `--readers` threads (default `1,2,4,8,16,32`) against each of
+ *   `--stores` while a writer thread updates records (unless `--writer=false`), for `--duration` seconds each.
+ *   `SQLite3Pool` is SQLite with a connection per thread. Accepts `--records`, `--min-size`, `--max-size`,
+ *   `--data-type` as in churn.
+ * - replay <trace>: Replays a trace file (see trace.h) against a new instance of each of `--stores`. Options:
+ *   `--threads`, `--timing` (`fast` to issue ops as fast as possible, or `original`), and `--data-type` for values.
+ *
+ * - aggregate <samples>: Aggregates a samples file recorded with `--record-samples` back into the CSV the full
+ *   benchmark writes.
+ * - compare <baseline samples>: Reruns the combinations in a samples file recorded with `--record-samples` and
+ *   flags the ops whose latencies changed significantly with a Mann-Whitney U test (see `Benchmark::compare`). Pick
+ *   the combinations to rerun with `--stores` and `--records` (default all of them). A change is significant below
+ *   `--alpha` (default 0.01) and counts if the median moved more than `--threshold` percent (default 5). Exits with
+ *   1 if there are any regressions. The rerun's samples go to `--record-samples`, so it can be the next baseline.
+ * - generators: Measures the throughput of generating random values in GB/s.
+ *
+ * All modes accept `--hardware` to skip the prompt for the system name, `--stores` to pick store types, and `--seed`
+ * to make the generated data reproducible. Options are `--name=value`, and unknown options are an error (see `Args`).
+ * `--size-distributions` picks how value sizes are distributed within each size range, any of `uniform` (default),
+ * `fixed`, `lognormal` (`--lognormal-sigma`), `pareto` (`--pareto-alpha`), or `empirical` (`--size-histogram` file,
+ * see `utils::EmpiricalSize`). churn, expire, and openloop only use the first one. `--record-trace=<file>` records
+ * the ops the benchmark runs on each store to its own trace next to the file, which can be passed to replay, see
+ * `Benchmark::startTrace`. `--record-samples=<file>` records every timed op of the full benchmark to a samples file
+ * (see samples.h). `--metrics=<file>` rewrites a Prometheus text file with the current combination, throughput,
+ * latency percentiles, and memory of the full benchmark every `--metrics-interval` seconds (default 10, see
+ * metrics.h). `--metrics-disk-usage=true` adds the store's disk usage, which walks its files every interval while
+ * ops are being timed.
+ * `--key-formats` (`hex`, `binary`, `varint`, `uuidv7`) and `--insertion-orders` (`random`, `sequential`) add how
+ * keys are encoded and the order they're inserted in as dimensions, see `utils::KeyGenerator`. hex and binary keys
+ * are hashes, so they're only run in random order. churn, expire, and openloop only use the first of each.
+ * `--memory-budgets` adds memory budgets in MiB as a dimension, e.g. `default,256,64,16`, which `storeFactory` splits
+ * between each engine's caches and buffers. churn, expire, openloop, and replay only use the first one. With
+ * `--memory-cgroup=true` the process also runs in a cgroup v2 limited to the budget, if the current cgroup is
+ * writable, so the page cache the file stores rely on is limited too. The limit leaves some headroom for the harness
+ * itself, see `Benchmark::limitMemory`.
+ * `--cpus`, `--engine-cpus`, `--engine-threads`, and `--numa-nodes` control where threads run and memory is allocated,
+ * see `placeThreads`. The topology and placement are written next to the output in a `.topology.txt` file.
+ * `--store-dirs` lists the directories to save the stores in (default `out/stores`), e.g. on different file systems.
+ * The stores go in a `kv-benchmark-stores` subdirectory of each, which is the only thing the benchmark deletes, so a
+ * mount point can be passed directly. The full benchmark runs in each one and records its file system type and mount
+ * options, while other modes only use the first. `--tmpfs-baseline=true` adds /dev/shm as a baseline without disk IO.
+ */
 int main(int argc, char** argv) {
     doctest::Context context;
     context.setOption("minimal", true); // only show if errors occur.
@@ -245,27 +1603,73 @@ int main(int argc, char** argv) {
     int res = context.run();
     if(context.shouldExit()) return res;
 
-    string hardware; 
-    std::cout << "Name of the system the benchmark is running on: ";
-    std::cin >> hardware; // Get user input from the keyboard
+    Args args(argc, argv);
+    string mode = args.positional.empty() ? "" : args.positional[0];
 
-    std::cout << "Starting benchmark...\n";
+    string hardware = args.get("hardware", "");
+    if (hardware.empty()) {
+        std::cout << "Name of the system the benchmark is running on: ";
+        std::cin >> hardware; // Get user input from the keyboard
+    }
 
-    const std::time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
-    std::stringstream nowStr;
-    nowStr << std::put_time(std::localtime(&now), "%Y%m%d%H%M%S");
-    path outFilePath = path("out") / "benchmarks" / ("benchmark"s + nowStr.str() + ".csv");
+    string placement = placeThreads(args);
 
-    fs::create_directories(outFilePath.parent_path());
-    std::ofstream output(outFilePath);
+    if (args.options.count("seed"))
+        utils::seed(std::stoull(args.get("seed", "")));
+    std::cout << "Starting benchmark with seed " << utils::getSeed() << "...\n";
 
     utils::ClobGenerator randClob{"./randomText"};
+
+    vector<pair<string, function<SizeDistributionPtr()>>> knownSizeDistributions{
+        {"uniform", []() { return std::make_shared<utils::UniformSize>(); }},
+        {"fixed", []() { return std::make_shared<utils::FixedSize>(); }},
+        {"lognormal", [&]() {
+            return std::make_shared<utils::LogNormalSize>(std::stod(args.get("lognormal-sigma", "1")));
+        }},
+        {"pareto", [&]() { return std::make_shared<utils::ParetoSize>(std::stod(args.get("pareto-alpha", "1.16"))); }},
+        {"empirical", [&]() {
+            if (!args.options.count("size-histogram"))
+                throw std::runtime_error("The empirical size distribution needs --size-histogram=<file>");
+            return std::make_shared<utils::EmpiricalSize>(args.get("size-histogram", ""));
+        }},
+    };
+    vector<pair<string, SizeDistributionPtr>> sizeDistributions; // in the order given
+    for (auto& name : args.getList("size-distributions", {"uniform"})) {
+        auto known = std::find_if(knownSizeDistributions.begin(), knownSizeDistributions.end(),
+                                  [&](auto& dist) { return dist.first == name; });
+        if (known == knownSizeDistributions.end()) {
+            vector<string> names;
+            for (auto& [knownName, makeDist] : knownSizeDistributions)
+                names.push_back(knownName);
+            throw std::runtime_error("Unknown size distribution " + name + ", expected any of " +
+                                     utils::join(names, ", "));
+        }
+        sizeDistributions.push_back({name, known->second()});
+    }
+
+    vector<size_t> memoryBudgets;
+    for (auto& budget : args.getList("memory-budgets", {"default"}))
+        memoryBudgets.push_back(budget == "default" ? 0 : std::stoull(budget) * MiB);
+
+    vector<path> storeDirs;
+    for (auto& dir : args.getList("store-dirs", {"out/stores"}))
+        storeDirs.push_back(dir);
+    if (args.get("tmpfs-baseline", "false") == "true") {
+        // A file system in memory, to separate the engines' CPU cost from IO
+        if (fs::is_directory("/dev/shm") && utils::fileSystemInfo("/dev/shm").type == "tmpfs")
+            storeDirs.push_back("/dev/shm");
+        else
+            std::cout << "Not running the tmpfs baseline: /dev/shm isn't a tmpfs\n";
+    }
+
     Benchmark benchmark{
-        "out/stores", // storeDir
+        storeDirs, // storeDirs
         hardware, // hardware
         1000, // repeats
         10 * GiB, // maxDbSize
-        {"LevelDB", "RocksDB", "BerkeleyDB", "FlatFolder", "NestedFolder", "SQLite3"}, // storeTypes
+        args.getList("stores", {"LevelDB", "RocksDB", "BerkeleyDB", "FlatFolder", "NestedFolder", "NestedFolderFd",
+                                "NestedFolderAuto", "NestedFolderResharding", "PosixFile", "SQLite3",
+                                "HybridRocksDB", "RocksDBBlob", "BerkeleyDBEnv", "BerkeleyDBEnvHash"}),
         storeFactory, // storeFactory
         { // sizeRanges
             {1, 1*KiB - 1},
@@ -282,8 +1686,232 @@ int main(int argc, char** argv) {
             {"incompressible", [](auto size) { return utils::randBlob(size); }},
             {"compressible", randClob},
         },
+        sizeDistributions,
+        memoryBudgets,
+        args.getList("key-formats", {"hex"}),
+        args.getList("insertion-orders", {"random"}),
+    };
+    if (args.options.count("record-trace"))
+        benchmark.tracePath = args.get("record-trace", "");
+    benchmark.sampling = {
+        (size_t) args.getInt("warmup", 0),
+        std::stod(args.get("target-error", "0")),
+        std::stod(args.get("ci-percentile", "0")),
+        std::stod(args.get("confidence", "0.95")),
+        (size_t) args.getInt("min-samples", 30),
+        (size_t) args.getInt("max-samples", 100'000),
+        chrono::seconds(args.getInt("time-budget", 60)),
     };
-    benchmark.run(output);
+    if (args.options.count("record-samples") && mode != "compare") // compare records the samples of its rerun itself
+        benchmark.sampleWriter = std::make_shared<samples::SampleWriter>(args.get("record-samples", ""));
+    if (args.options.count("metrics")) {
+        benchmark.metricsExporter = std::make_shared<metrics::MetricsExporter>(
+            args.get("metrics", ""), chrono::seconds(args.getInt("metrics-interval", 10)),
+            args.get("metrics-disk-usage", "false") == "true");
+    }
+    if (args.get("memory-cgroup", "false") == "true") {
+        try {
+            benchmark.memoryCgroup = std::make_shared<utils::MemoryCgroup>();
+        } catch (const std::exception& e) {
+            std::cout << "Not limiting memory with a cgroup: " << e.what() << "\n";
+        }
+    }
+
+    if (mode != "") { // the full benchmark runs in each of the storeDirs, other modes only use the first
+        benchmark.useStoreDir(storeDirs.at(0));
+        placement += "store dir: " + benchmark.storeDir.native() + " (" + benchmark.fileSystem.type + " " +
+                     benchmark.fileSystem.options + ")\n";
+    }
+
+    path outFilePath;
+    int exitCode = 0;
+    if (mode == "") {
+        outFilePath = outputPath("benchmark");
+        std::ofstream output(outFilePath);
+        warnUnorderedKeyFormats(benchmark.keyFormats, benchmark.insertionOrders);
+        benchmark.run(output);
+    } else if (mode == "churn" || mode == "expire" || mode == "openloop" || mode == "overhead" ||
+               mode == "readscaling") {
+        auto parseMix = [&](vector<string> fallback) {
+            std::map<string, double> mix;
+            for (auto& weight : args.getList("mix", fallback)) {
+                auto colon = weight.find(':');
+                mix[weight.substr(0, colon)] = std::stod(weight.substr(colon + 1));
+            }
+            return mix;
+        };
+
+        size_t records = args.getInt("records", 100'000);
+        UsagePattern pattern{
+            {(size_t) args.getInt("min-size", 1*KiB), (size_t) args.getInt("max-size", 10*KiB - 1)},
+            {records, records},
+            args.get("data-type", "incompressible"),
+            sizeDistributions.at(0).first,
+            memoryBudgets.at(0),
+            benchmark.keyFormats.at(0),
+            benchmark.insertionOrders.at(0),
+        };
+        if (pattern.insertionOrder != "random" && !utils::KeyGenerator::hasOrder(pattern.keyFormat)) {
+            throw std::runtime_error(pattern.keyFormat + " keys are hashes, so they can only be inserted in random "
+                                     "order. Use --key-formats=varint or uuidv7 for --insertion-orders=" +
+                                     pattern.insertionOrder);
+        }
+        auto dataGen = std::find_if(benchmark.dataTypes.begin(), benchmark.dataTypes.end(),
+                                    [&](auto& dataType) { return dataType.first == pattern.dataType; });
+        if (dataGen == benchmark.dataTypes.end())
+            throw std::runtime_error("Unknown data type "s + pattern.dataType);
+        auto sizeDist = std::find_if(benchmark.sizeDistributions.begin(), benchmark.sizeDistributions.end(),
+                                     [&](auto& dist) { return dist.first == pattern.sizeDistribution; });
+        if (sizeDist == benchmark.sizeDistributions.end())
+            throw std::runtime_error("Unknown size distribution "s + pattern.sizeDistribution);
+        ValueGenerator valueGen = Benchmark::makeValueGenerator(dataGen->second, sizeDist->second);
+
+        outFilePath = outputPath(mode);
+        std::ofstream output(outFilePath);
+        if (mode == "churn") {
+            ChurnOptions options{
+                chrono::seconds(args.getInt("duration", 600)),
+                (size_t) args.getInt("ops", 0),
+                parseMix({"insert:1", "update:1", "remove:1", "get:1"}),
+                chrono::seconds(args.getInt("space-interval", 10)),
+            };
+            output << Benchmark::CHURN_CSV_HEADER;
+            for (auto& storeType : benchmark.storeTypes) {
+                std::cout << storeType << "\n";
+                benchmark.churn(output, storeType, pattern, valueGen, options);
+            }
+        } else if (mode == "expire") {
+            ExpireOptions options{
+                (size_t) args.getInt("batches", 5),
+                std::stod(args.get("fraction", "0.1")),
+                args.get("expire-by", "range"),
+            };
+            output << Benchmark::EXPIRE_CSV_HEADER;
+            for (auto& storeType : benchmark.storeTypes) {
+                std::cout << storeType << "\n";
+                benchmark.expire(output, storeType, pattern, valueGen, options);
+            }
+        } else if (mode == "readscaling") {
+            ReadScalingOptions options{
+                {},
+                chrono::seconds(args.getInt("duration", 10)),
+                args.get("writer", "true") == "true",
+            };
+            for (auto& readers : args.getList("readers", {"1", "2", "4", "8", "16", "32"}))
+                options.readers.push_back(std::stoul(readers));
+
+            output << Benchmark::READ_SCALING_CSV_HEADER;
+            for (auto& storeType : benchmark.storeTypes)
+                benchmark.readScaling(output, storeType, pattern, valueGen, options);
+        } else if (mode == "overhead") {
+            output << Benchmark::OVERHEAD_CSV_HEADER;
+            for (auto& storeType : benchmark.storeTypes) {
+                std::cout << storeType << "\n";
+                benchmark.overhead(output, storeType, pattern, valueGen);
+            }
+        } else {
+            OpenLoopOptions options{
+                {},
+                chrono::seconds(args.getInt("duration", 10)),
+                args.get("arrival", "poisson"),
+                parseMix({"update:1", "get:1"}),
+                std::stod(args.get("saturation", "0.95")),
+            };
+            for (auto& rate : args.getList("rates", {"100", "200", "500", "1000", "2000", "5000", "10000", "20000",
+                                                      "50000", "100000", "200000"}))
+                options.rates.push_back(std::stod(rate));
+
+            output << Benchmark::OPEN_LOOP_CSV_HEADER;
+            for (auto& storeType : benchmark.storeTypes) {
+                double saturation = benchmark.openLoop(output, storeType, pattern, valueGen, options);
+                std::cout << storeType << " sustained " << saturation << " ops/s\n";
+            }
+        }
+    } else if (mode == "replay") {
+        if (args.positional.size() < 2)
+            throw std::runtime_error("Usage: benchmark replay <trace>");
+        path tracePath = args.positional[1];
+        trace::ReplayOptions options{
+            (unsigned) args.getInt("threads", 1),
+            args.get("timing", "fast") == "original",
+        };
+        UsagePattern pattern{{0, 0}, {0, 0}, args.get("data-type", "incompressible"), "uniform", memoryBudgets.at(0)};
+        auto dataGen = std::find_if(benchmark.dataTypes.begin(), benchmark.dataTypes.end(),
+                                    [&](auto& dataType) { return dataType.first == pattern.dataType; });
+        if (dataGen == benchmark.dataTypes.end())
+            throw std::runtime_error("Unknown data type "s + pattern.dataType);
+
+        outFilePath = outputPath("replay");
+        std::ofstream output(outFilePath);
+        output << Benchmark::REPLAY_CSV_HEADER;
+        for (auto& storeType : benchmark.storeTypes) {
+            std::cout << storeType << "\n";
+            benchmark.replay(output, storeType, tracePath, pattern, dataGen->second, options);
+        }
+    } else if (mode == "aggregate") {
+        if (args.positional.size() < 2)
+            throw std::runtime_error("Usage: benchmark aggregate <samples>");
+        outFilePath = outputPath("aggregate");
+        std::ofstream output(outFilePath);
+        Benchmark::aggregate(output, args.positional[1]);
+    } else if (mode == "compare") {
+        if (args.positional.size() < 2)
+            throw std::runtime_error("Usage: benchmark compare <baseline samples>");
+        outFilePath = outputPath("compare");
+        path runPath = path(outFilePath).replace_extension(".run.csv");
+        CompareOptions options{
+            args.getList("stores", {}),
+            {},
+            args.get("record-samples", path(outFilePath).replace_extension(".samples").native()),
+            std::stod(args.get("alpha", "0.01")),
+            std::stod(args.get("threshold", "5")) / 100,
+        };
+        for (auto& records : args.getList("records", {}))
+            options.records.push_back(std::stoull(records));
+
+        std::ofstream output(outFilePath), runOutput(runPath);
+        size_t regressions = benchmark.compare(output, runOutput, args.positional[1], options);
+        std::cout << regressions << " regressions, the rerun is in " << std::quoted(runPath.native()) << " and "
+                  << std::quoted(options.samplesPath.native()) << "\n";
+        if (regressions > 0)
+            exitCode = 1;
+    } else if (mode == "generators") {
+        outFilePath = outputPath("generators");
+        std::ofstream output(outFilePath);
+        output << "hardware,generator,size,bytes,seconds,GB/s\n";
+
+        // The byte at a time mt19937 generator randBlob used to use, for comparison
+        DataGenerator mt19937Blob = [](size_t size) {
+            std::uniform_int_distribution<unsigned char> randChar(0, 0xFF);
+            string blob(size, '\0');
+            std::generate(blob.begin(), blob.end(), [&]() { return randChar(utils::randGen); });
+            return blob;
+        };
+        vector<pair<string, DataGenerator>> generators{
+            {"mt19937 randBlob", mt19937Blob},
+            {"randBlob", [](size_t size) { return utils::randBlob(size); }},
+            {"ClobGenerator", randClob},
+        };
+        for (auto& [name, generator] : generators) {
+            for (size_t size : {64UL, 1*KiB, 64*KiB, 1*MiB}) {
+                size_t total = 0;
+                auto time = utils::timeIt([&]() {
+                    while (total < 256 * MiB)
+                        total += generator(size).size();
+                });
+                double seconds = chrono::duration<double>(time).count();
+                output << hardware << "," << name << "," << utils::prettySize(size) << "," << total << "," <<
+                    seconds << "," << (total / seconds / 1e9) << "\n";
+                std::cout << name << " " << utils::prettySize(size) << ": " << (total / seconds / 1e9) << " GB/s\n";
+            }
+        }
+    } else {
+        throw std::runtime_error("Unknown mode "s + mode);
+    }
+
+    path placementPath = path(outFilePath).replace_extension(".topology.txt");
+    std::ofstream(placementPath) << placement;
 
     std::cout << "Benchmark written to " << std::quoted(outFilePath.native()) << "\n";
-}
\ No newline at end of file
+    return exitCode;
+}
@@ -0,0 +1,203 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "metrics.h"
+#include "utils.h"
+
+namespace metrics {
+    namespace fs = std::filesystem;
+    using fs::path;
+    namespace chrono = std::chrono;
+    using std::string, std::vector;
+
+    /** Escapes a label value, see the Prometheus text format */
+    static string escapeLabel(const string& value) {
+        string escaped;
+        for (char c : value) {
+            if (c == '\\') escaped += "\\\\";
+            else if (c == '"') escaped += "\\\"";
+            else if (c == '\n') escaped += "\\n";
+            else escaped += c;
+        }
+        return escaped;
+    }
+
+    static string formatLabels(const std::map<string, string>& labels) {
+        vector<string> pairs;
+        for (auto& [name, value] : labels)
+            pairs.push_back(name + "=\"" + escapeLabel(value) + "\"");
+        return "{" + utils::join(pairs, ",") + "}";
+    }
+
+
+    size_t LatencyHistogram::bucket(long long value) {
+        uint64_t v = std::max(value, 0LL);
+        // Shift v down until it fits in [SUB_BUCKETS, 2 * SUB_BUCKETS), each shift is the next 64 buckets
+        size_t shift = 0;
+        while ((v >> shift) >= 2 * SUB_BUCKETS)
+            shift++;
+        return shift * SUB_BUCKETS + (v >> shift);
+    }
+
+    long long LatencyHistogram::bucketValue(size_t bucket) {
+        if (bucket < 2 * SUB_BUCKETS)
+            return bucket;
+        size_t shift = bucket / SUB_BUCKETS - 1;
+        uint64_t low = uint64_t(bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+        return low + (uint64_t(1) << shift) / 2;
+    }
+
+    void LatencyHistogram::record(long long value) {
+        counts[bucket(value)]++;
+        _count++;
+        _max = std::max(_max, value);
+    }
+
+    long long LatencyHistogram::percentile(double p) const {
+        if (_count == 0) return 0;
+        uint64_t rank = std::max<uint64_t>(std::ceil(p / 100 * _count), 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min(bucketValue(i), _max); // the max is exact
+        }
+        return _max;
+    }
+
+
+    MetricsExporter::MetricsExporter(const path& filepath, chrono::seconds interval, bool diskUsage) :
+        filepath(filepath), interval(interval), diskUsage(diskUsage), combinationStart(chrono::steady_clock::now()),
+        windowStart(chrono::steady_clock::now()) {
+        if (!filepath.parent_path().empty())
+            fs::create_directories(filepath.parent_path());
+        write(); // fail early if the file can't be written
+
+        writer = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!closed) {
+                if (!changed.wait_for(lock, this->interval, [&]() { return closed; })) {
+                    lock.unlock();
+                    try {
+                        write();
+                    } catch (const std::exception& e) { // don't stop a long run because the dashboard missed one
+                        std::cerr << e.what() << "\n";
+                    }
+                    lock.lock();
+                }
+            }
+        });
+    }
+
+    MetricsExporter::~MetricsExporter() {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            closed = true;
+            changed.notify_all();
+        }
+        writer.join();
+        write(); // leave the final totals
+    }
+
+    void MetricsExporter::combination(const std::map<string, string>& labels, const path& storeDir) {
+        std::unique_lock<std::mutex> lock(mutex);
+        this->labels = labels;
+        this->storeDir = storeDir;
+        combinations++;
+        combinationStart = chrono::steady_clock::now();
+    }
+
+    void MetricsExporter::record(trace::Op op, chrono::nanoseconds latency) {
+        std::unique_lock<std::mutex> lock(mutex);
+        window[op].record(latency.count());
+        totals[op]++;
+    }
+
+    void MetricsExporter::write() {
+        // Take the window and a copy of the rest, so the benchmark isn't blocked while we compute and write
+        std::map<trace::Op, LatencyHistogram> latencies;
+        std::map<string, string> labels;
+        path storeDir;
+        uint64_t combinations;
+        std::map<trace::Op, uint64_t> totals;
+        auto now = chrono::steady_clock::now();
+        double windowSeconds, combinationSeconds;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            std::swap(latencies, window);
+            labels = this->labels;
+            storeDir = this->storeDir;
+            combinations = this->combinations;
+            totals = this->totals;
+            windowSeconds = chrono::duration<double>(now - windowStart).count();
+            combinationSeconds = chrono::duration<double>(now - combinationStart).count();
+            windowStart = now;
+        }
+
+        long long diskUsage = 0;
+        if (this->diskUsage && !storeDir.empty() && fs::exists(storeDir)) {
+            try {
+                diskUsage = utils::diskUsage(storeDir);
+            } catch (const std::exception&) {
+                // the store can change under du, just report 0 this time
+            }
+        }
+
+        std::stringstream out;
+        out << "# HELP kv_benchmark_combination_info The combination currently running\n"
+            << "# TYPE kv_benchmark_combination_info gauge\n"
+            << "kv_benchmark_combination_info" << formatLabels(labels) << " 1\n"
+            << "# TYPE kv_benchmark_combinations_started_total counter\n"
+            << "kv_benchmark_combinations_started_total " << combinations << "\n"
+            << "# HELP kv_benchmark_combination_seconds Time since the current combination started\n"
+            << "# TYPE kv_benchmark_combination_seconds gauge\n"
+            << "kv_benchmark_combination_seconds " << combinationSeconds << "\n";
+
+        out << "# TYPE kv_benchmark_ops_total counter\n";
+        for (auto& [op, total] : totals)
+            out << "kv_benchmark_ops_total{op=\"" << trace::opName(op) << "\"} " << total << "\n";
+
+        out << "# HELP kv_benchmark_ops_per_second Op throughput over the last interval\n"
+            << "# TYPE kv_benchmark_ops_per_second gauge\n";
+        for (auto& [op, total] : totals) {
+            double rate = windowSeconds > 0 ? latencies[op].count() / windowSeconds : 0;
+            out << "kv_benchmark_ops_per_second{op=\"" << trace::opName(op) << "\"} " << rate << "\n";
+        }
+
+        out << "# HELP kv_benchmark_latency_nanoseconds Op latency percentiles over the last interval\n"
+            << "# TYPE kv_benchmark_latency_nanoseconds gauge\n";
+        for (auto& [op, histogram] : latencies) {
+            if (histogram.count() == 0) continue;
+            for (double quantile : {0.5, 0.9, 0.99, 1.0}) {
+                out << "kv_benchmark_latency_nanoseconds{op=\"" << trace::opName(op) << "\",quantile=\""
+                    << quantile << "\"} " << histogram.percentile(quantile * 100) << "\n";
+            }
+        }
+
+        out << "# TYPE kv_benchmark_resident_memory_bytes gauge\n"
+            << "kv_benchmark_resident_memory_bytes " << utils::getMemUsage() * 1024 << "\n";
+        if (this->diskUsage) {
+            out << "# HELP kv_benchmark_disk_usage_bytes Disk usage of the current store\n"
+                << "# TYPE kv_benchmark_disk_usage_bytes gauge\n"
+                << "kv_benchmark_disk_usage_bytes " << diskUsage << "\n";
+        }
+
+        std::unique_lock<std::mutex> lock(fileMutex);
+        path tempPath = filepath;
+        tempPath += ".tmp";
+        {
+            std::ofstream file(tempPath, std::ofstream::out|std::ofstream::trunc);
+            file << out.str();
+            file.flush();
+            if (!file)
+                throw std::runtime_error("Couldn't write metrics file " + tempPath.native());
+        }
+        fs::rename(tempPath, filepath); // atomic, so readers never see a partial file
+    }
+}
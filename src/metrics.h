@@ -0,0 +1,100 @@
+/**
+ * Live metrics for watching long benchmark runs, e.g. on a dashboard or to abort a bad run early.
+ *
+ * The metrics are written in the Prometheus text format (see
+ * https://prometheus.io/docs/instrumenting/exposition_formats/) to a file that is rewritten every few seconds, so it
+ * can be picked up by node_exporter's textfile collector or just watched with `cat`. The file is written to a
+ * temporary file next to it and renamed over it, so readers never see a partial file. Metrics:
+ * - kv_benchmark_combination_info: 1, with the current combination as labels
+ * - kv_benchmark_combinations_started_total
+ * - kv_benchmark_combination_seconds: time since the current combination started
+ * - kv_benchmark_ops_total{op}: ops timed since the start
+ * - kv_benchmark_ops_per_second{op}: over the last interval
+ * - kv_benchmark_latency_nanoseconds{op,quantile}: p50, p90, p99, and max over the last interval, within 1%
+ * - kv_benchmark_resident_memory_bytes
+ * - kv_benchmark_disk_usage_bytes: of the current store, only if enabled. Measuring it walks the store's files every
+ *   interval, which adds IO and page cache use while the ops are being timed.
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+#include <array>
+
+#include "trace.h"
+
+namespace metrics {
+    /**
+     * A fixed size histogram of latencies in nanoseconds, so the memory the metrics use doesn't grow with the op rate
+     * and skew the memory results. Latencies under 128ns get a bucket each, and each power of 2 above that is split
+     * into 64 buckets, so percentiles are within 1% of the exact ones.
+     */
+    class LatencyHistogram {
+        static const int SUB_BUCKETS = 64;
+        /** Enough buckets for 63 bit values, which are shifted by up to 56 */
+        std::array<uint64_t, 58 * SUB_BUCKETS> counts{};
+        uint64_t _count = 0;
+        long long _max = 0;
+
+        static size_t bucket(long long value);
+        /** The middle of the bucket's range */
+        static long long bucketValue(size_t bucket);
+
+    public:
+        void record(long long value);
+
+        uint64_t count() const { return _count; }
+
+        /** The pth percentile (0 to 100) using the nearest-rank method, or 0 if nothing was recorded */
+        long long percentile(double p) const;
+    };
+
+    /**
+     * Collects op latencies and rewrites the metrics file every interval on a background thread. Recording an op is
+     * just adding its latency to a histogram under a lock, the percentiles are computed on the background thread.
+     */
+    class MetricsExporter {
+        std::filesystem::path filepath;
+        std::chrono::seconds interval;
+        bool diskUsage;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        /** Held while writing the file */
+        std::mutex fileMutex;
+        bool closed = false;
+        std::thread writer;
+
+        std::map<std::string, std::string> labels;
+        std::filesystem::path storeDir;
+        uint64_t combinations = 0;
+        std::chrono::steady_clock::time_point combinationStart;
+        /** Latencies of the ops since the last write */
+        std::map<trace::Op, LatencyHistogram> window;
+        std::chrono::steady_clock::time_point windowStart;
+        std::map<trace::Op, uint64_t> totals;
+
+    public:
+        /** Writes to filepath every interval until destroyed. diskUsage enables kv_benchmark_disk_usage_bytes. */
+        MetricsExporter(const std::filesystem::path& filepath, std::chrono::seconds interval, bool diskUsage = false);
+        ~MetricsExporter();
+
+        /**
+         * Starts a new combination, described by labels (e.g. {"store", "RocksDB"}). The disk usage of storeDir is
+         * reported until the next combination, if enabled.
+         */
+        void combination(const std::map<std::string, std::string>& labels, const std::filesystem::path& storeDir);
+
+        /** Record an op that just finished */
+        void record(trace::Op op, std::chrono::nanoseconds latency);
+
+        /** Rewrites the metrics file now, and starts a new interval */
+        void write();
+    };
+}
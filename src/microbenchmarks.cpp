@@ -0,0 +1,219 @@
+/**
+ * Fast microbenchmarks of the store wrappers and the data generators using Google Benchmark, to catch regressions in
+ * minutes rather than running the full benchmark for hours.
+ *
+ * Usage: `microbenchmarks [--benchmark_filter=<regex>] [--benchmark_out=<file>] [google benchmark options...]`
+ * Writes JSON results to out/microbenchmarks/microbenchmarks<timestamp>.json unless `--benchmark_out` is given. Two
+ * runs can be diffed with Google Benchmark's `tools/compare.py benchmarks <old.json> <new.json>`.
+ */
+#include <filesystem>
+#include <memory>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <functional>
+#include <iomanip>
+#include <ctime>
+#include <sstream>
+#include <algorithm>
+#include <benchmark/benchmark.h>
+
+#include "stores.h"
+#include "utils.h"
+
+namespace fs = std::filesystem;
+using fs::path;
+namespace chrono = std::chrono;
+using std::string, std::vector, std::pair, std::function, std::make_unique;
+using utils::KiB, utils::MiB;
+using StorePtr = std::unique_ptr<stores::Store>;
+
+const path STORE_DIR = path("out") / "microbenchmarks" / "stores";
+/** Number of records in the store for get, update, and remove */
+const size_t RECORDS = 1000;
+/** Inserts clear the store once it gets this big, so long runs don't fill the disk */
+const size_t MAX_INSERTS = 10'000;
+const vector<long> VALUE_SIZES{64, 1 * KiB, 64 * KiB};
+
+/** Records at least this big go in files in the hybrid stores and in blob files in RocksDBBlob, like main.cpp */
+const size_t HYBRID_THRESHOLD = 64 * KiB;
+
+/**
+ * Each store class with its default settings, like the tests, plus the configurations the full benchmark runs that
+ * take a different code path (the pool of SQLite connections, Berkeley DB in an environment, RocksDB's BlobDB, and the
+ * hybrid stores). The 64 KiB values put the hybrid and blob stores' records in their files.
+ */
+const vector<pair<string, function<StorePtr(const path&)>>> STORES{
+    {"SQLite3", [](auto& filepath) { return make_unique<stores::SQLite3Store>(filepath); }},
+    {"SQLite3Pool", [](auto& filepath) { return make_unique<stores::SQLite3PoolStore>(filepath); }},
+    {"LevelDB", [](auto& filepath) { return make_unique<stores::LevelDBStore>(filepath); }},
+    {"RocksDB", [](auto& filepath) { return make_unique<stores::RocksDBStore>(filepath); }},
+    {"RocksDBBlob", [](auto& filepath) {
+        rocksdb::Options options;
+        options.enable_blob_files = true;
+        options.min_blob_size = HYBRID_THRESHOLD;
+        options.enable_blob_garbage_collection = true;
+        return make_unique<stores::RocksDBStore>(filepath, options);
+    }},
+    {"BerkeleyDB", [](auto& filepath) { return make_unique<stores::BerkeleyDBStore>(filepath); }},
+    {"BerkeleyDBEnv", [](auto& filepath) {
+        return make_unique<stores::BerkeleyDBStore>(filepath, stores::BerkeleyDBEnvOptions{});
+    }},
+    {"FlatFolder", [](auto& filepath) { return make_unique<stores::FlatFolderStore>(filepath); }},
+    {"NestedFolder", [](auto& filepath) { return make_unique<stores::NestedFolderStore>(filepath, 2, 3, 32); }},
+    {"NestedFolderFd", [](auto& filepath) { return make_unique<stores::NestedFolderFdStore>(filepath, 2, 3, 32); }},
+    {"NestedFolderResharding", [](auto& filepath) {
+        return make_unique<stores::ReshardingFolderStore>(filepath, 2, 256, 32);
+    }},
+    {"PosixFile", [](auto& filepath) { return make_unique<stores::PosixFileStore>(filepath); }},
+    {"HybridSQLite3", [](auto& filepath) {
+        auto makeDb = [](const path& dbPath) { return make_unique<stores::SQLite3Store>(dbPath); };
+        return make_unique<stores::HybridStore>(filepath, makeDb, HYBRID_THRESHOLD);
+    }},
+    {"HybridRocksDB", [](auto& filepath) {
+        auto makeDb = [](const path& dbPath) { return make_unique<stores::RocksDBStore>(dbPath); };
+        return make_unique<stores::HybridStore>(filepath, makeDb, HYBRID_THRESHOLD);
+    }},
+    {"Memory", [](auto& filepath) { return make_unique<stores::MemoryStore>(filepath); }},
+};
+
+/** Returns `utils::genKey(start..start + count - 1)`, so the benchmarks don't time hashing the keys */
+vector<string> genKeys(size_t start, size_t count) {
+    vector<string> keys;
+    for (size_t i = start; i < start + count; i++)
+        keys.push_back(utils::genKey(i));
+    return keys;
+}
+
+/** Creates a fresh store with RECORDS records of size bytes, keyed by `utils::genKey(0..RECORDS - 1)` */
+StorePtr makeStore(const string& name, const function<StorePtr(const path&)>& factory, size_t size, bool fill) {
+    fs::remove_all(STORE_DIR / name);
+    fs::create_directories(STORE_DIR);
+    StorePtr store = factory(STORE_DIR / name);
+    if (fill) {
+        vector<pair<string, string>> records;
+        for (auto& key : genKeys(0, RECORDS))
+            records.push_back({key, utils::randBlob(size)});
+        store->bulkInsert(records);
+    }
+    return store;
+}
+
+void registerStoreBenchmarks() {
+    for (auto& storeType : STORES) {
+        auto registerOp = [&](const string& op, function<void(benchmark::State&, StorePtr&, size_t)> run) {
+            auto bench = benchmark::RegisterBenchmark(("Store/" + storeType.first + "/" + op).c_str(),
+                [name = storeType.first, factory = storeType.second, op, run](benchmark::State& state) {
+                    size_t size = state.range(0);
+                    StorePtr store = makeStore(name, factory, size, op != "insert");
+                    run(state, store, size);
+                    state.SetItemsProcessed(state.iterations());
+                    state.SetBytesProcessed(state.iterations() * size);
+                    store.reset();
+                    fs::remove_all(STORE_DIR / name);
+                });
+            for (auto size : VALUE_SIZES)
+                bench->Arg(size);
+            bench->Unit(benchmark::kMicrosecond)->UseRealTime(); // most of the time is waiting on IO
+        };
+
+        registerOp("insert", [](benchmark::State& state, StorePtr& store, size_t size) {
+            string value = utils::randBlob(size);
+            vector<string> keys = genKeys(RECORDS, MAX_INSERTS);
+            size_t i = 0;
+            for (auto _ : state) {
+                if (i == MAX_INSERTS) {
+                    state.PauseTiming();
+                    store->bulkRemove(keys);
+                    i = 0;
+                    state.ResumeTiming();
+                }
+                store->insert(keys[i++], value);
+            }
+        });
+        registerOp("get", [](benchmark::State& state, StorePtr& store, size_t) {
+            vector<string> keys = genKeys(0, RECORDS);
+            size_t i = 0;
+            for (auto _ : state)
+                benchmark::DoNotOptimize(store->get(keys[i++ % RECORDS]));
+        });
+        registerOp("update", [](benchmark::State& state, StorePtr& store, size_t size) {
+            string value = utils::randBlob(size);
+            vector<string> keys = genKeys(0, RECORDS);
+            size_t i = 0;
+            for (auto _ : state)
+                store->update(keys[i++ % RECORDS], value);
+        });
+        registerOp("remove", [](benchmark::State& state, StorePtr& store, size_t size) {
+            vector<string> keys = genKeys(0, RECORDS);
+            size_t i = 0;
+            for (auto _ : state) {
+                if (i == RECORDS) { // put the records back
+                    state.PauseTiming();
+                    vector<pair<string, string>> records;
+                    for (auto& key : keys)
+                        records.push_back({key, utils::randBlob(size)});
+                    store->bulkInsert(records);
+                    i = 0;
+                    state.ResumeTiming();
+                }
+                store->remove(keys[i++]);
+            }
+        });
+    }
+}
+
+void registerGeneratorBenchmarks(const path& textFolder) {
+    benchmark::RegisterBenchmark("genKey", [](benchmark::State& state) {
+        size_t i = 0;
+        for (auto _ : state)
+            benchmark::DoNotOptimize(utils::genKey(i++));
+        state.SetItemsProcessed(state.iterations());
+    });
+
+    auto registerGenerator = [](const string& name, function<string(size_t)> generator) {
+        benchmark::RegisterBenchmark(name.c_str(), [generator](benchmark::State& state) {
+            for (auto _ : state)
+                benchmark::DoNotOptimize(generator(state.range(0)));
+            state.SetBytesProcessed(state.iterations() * state.range(0));
+        })->RangeMultiplier(16)->Range(64, 1 * MiB);
+    };
+    registerGenerator("randBlob", [](size_t size) { return utils::randBlob(size); });
+    if (fs::is_directory(textFolder))
+        registerGenerator("ClobGenerator", utils::ClobGenerator(textFolder));
+}
+
+/** Returns a path like out/microbenchmarks/microbenchmarks20220101120000.json */
+path outputPath() {
+    const std::time_t now = chrono::system_clock::to_time_t(chrono::system_clock::now());
+    std::stringstream nowStr;
+    nowStr << std::put_time(std::localtime(&now), "%Y%m%d%H%M%S");
+    path outFilePath = path("out") / "microbenchmarks" / ("microbenchmarks" + nowStr.str() + ".json");
+    fs::create_directories(outFilePath.parent_path());
+    return outFilePath;
+}
+
+int main(int argc, char** argv) {
+    // Default to writing JSON to a timestamped file, so runs from different builds can be compared
+    vector<string> defaults;
+    vector<char*> args(argv, argv + argc);
+    bool hasOut = std::any_of(args.begin(), args.end(), [](char* arg) {
+        return string(arg).rfind("--benchmark_out=", 0) == 0;
+    });
+    if (!hasOut) {
+        defaults = {"--benchmark_out=" + outputPath().native(), "--benchmark_out_format=json"};
+        for (auto& arg : defaults)
+            args.push_back(arg.data());
+    }
+    int argCount = args.size();
+    benchmark::Initialize(&argCount, args.data());
+    if (benchmark::ReportUnrecognizedArguments(argCount, args.data()))
+        return 1;
+
+    registerStoreBenchmarks();
+    registerGeneratorBenchmarks("./randomText");
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    fs::remove_all(STORE_DIR);
+    return 0;
+}
@@ -0,0 +1,242 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdexcept>
+
+#include "samples.h"
+
+namespace samples {
+    namespace fs = std::filesystem;
+    using fs::path;
+    namespace chrono = std::chrono;
+    using std::string, std::vector;
+
+    const string MAGIC = "KVSAMPL1";
+    /** Hand the write buffer to the background thread once it gets this big */
+    const size_t WRITE_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    static void writeVarint(string& buffer, uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back((char) value);
+    }
+
+    static void writeString(string& buffer, const string& str) {
+        writeVarint(buffer, str.size());
+        buffer += str;
+    }
+
+    static void writeDouble(string& buffer, double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        for (int i = 0; i < 8; i++)
+            buffer.push_back((char) (bits >> (i * 8)));
+    }
+
+
+    SampleWriter::SampleWriter(const path& filepath) :
+        file(filepath, std::ofstream::out|std::ofstream::binary|std::ofstream::trunc),
+        start(chrono::steady_clock::now()) {
+        if (!file.is_open())
+            throw std::runtime_error("Couldn't open samples file " + filepath.native());
+        buffer.reserve(WRITE_BUFFER_SIZE);
+        buffer += MAGIC;
+
+        flusher = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                changed.wait(lock, [&]() { return !pending.empty() || closed; });
+                if (pending.empty()) // closed
+                    return;
+                lock.unlock(); // write without blocking the benchmark from filling the next buffer
+                file.write(pending.data(), pending.size());
+                file.flush();
+                lock.lock();
+                pending.clear();
+                changed.notify_all();
+            }
+        });
+    }
+
+    SampleWriter::~SampleWriter() {
+        flush();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            closed = true;
+            changed.notify_all();
+        }
+        flusher.join();
+    }
+
+    void SampleWriter::handOff() {
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return pending.empty(); });
+        std::swap(buffer, pending);
+        buffer.clear();
+        changed.notify_all();
+    }
+
+    uint64_t SampleWriter::combination(const Combination& combination) {
+        uint64_t id = nextCombination++;
+        buffer.push_back((char) Record::Type::Combination);
+        writeVarint(buffer, id);
+        writeString(buffer, combination.hardware);
+        writeString(buffer, combination.store);
+        writeVarint(buffer, combination.size.min);
+        writeVarint(buffer, combination.size.max);
+        writeVarint(buffer, combination.count.min);
+        writeVarint(buffer, combination.count.max);
+        writeString(buffer, combination.dataType);
+        writeString(buffer, combination.sizeDistribution);
+        writeVarint(buffer, combination.memoryBudget);
+        writeString(buffer, combination.keyFormat);
+        writeString(buffer, combination.insertionOrder);
+        writeString(buffer, combination.storeDir);
+        writeString(buffer, combination.fileSystem);
+        writeString(buffer, combination.mountOptions);
+        return id;
+    }
+
+    void SampleWriter::sample(uint64_t combination, trace::Op op, uint64_t keyIndex, size_t valueSize,
+                              chrono::nanoseconds latency, const vector<uint64_t>& counters) {
+        auto timestamp = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        buffer.push_back((char) Record::Type::Sample);
+        writeVarint(buffer, combination);
+        buffer.push_back((char) op);
+        writeVarint(buffer, (timestamp - last).count());
+        writeVarint(buffer, keyIndex);
+        writeVarint(buffer, valueSize);
+        writeVarint(buffer, latency.count());
+        writeVarint(buffer, counters.size());
+        for (auto counter : counters)
+            writeVarint(buffer, counter);
+        last = timestamp;
+
+        if (buffer.size() >= WRITE_BUFFER_SIZE)
+            handOff();
+    }
+
+    void SampleWriter::engineStats(uint64_t combination, trace::Op op, const std::map<string, double>& stats) {
+        buffer.push_back((char) Record::Type::EngineStats);
+        writeVarint(buffer, combination);
+        buffer.push_back((char) op);
+        writeVarint(buffer, stats.size());
+        for (auto& [name, value] : stats) {
+            writeString(buffer, name);
+            writeDouble(buffer, value);
+        }
+    }
+
+    void SampleWriter::value(uint64_t combination, const string& name, uint64_t value) {
+        buffer.push_back((char) Record::Type::Value);
+        writeVarint(buffer, combination);
+        writeString(buffer, name);
+        writeVarint(buffer, value);
+    }
+
+    void SampleWriter::flush() {
+        handOff();
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&]() { return pending.empty(); });
+    }
+
+
+    SampleReader::SampleReader(const path& filepath) : file(filepath, std::ifstream::in|std::ifstream::binary) {
+        if (!file.is_open())
+            throw std::runtime_error("Couldn't open samples file " + filepath.native());
+        string magic(MAGIC.size(), '\0');
+        file.read(&magic[0], magic.size());
+        if (magic != MAGIC)
+            throw std::runtime_error(filepath.native() + " is not a samples file");
+    }
+
+    uint64_t SampleReader::readVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = file.get();
+            if (byte == EOF)
+                throw std::runtime_error("Samples file ends in the middle of a record");
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Invalid varint in samples file");
+    }
+
+    string SampleReader::readString() {
+        string str(readVarint(), '\0');
+        file.read(&str[0], str.size());
+        return str;
+    }
+
+    bool SampleReader::next(Record& record) {
+        int type = file.get();
+        if (type == EOF)
+            return false;
+
+        record.type = (Record::Type) type;
+        switch (record.type) {
+            case Record::Type::Combination: {
+                Combination& c = record.combination;
+                c.id = readVarint();
+                c.hardware = readString();
+                c.store = readString();
+                c.size.min = readVarint();
+                c.size.max = readVarint();
+                c.count.min = readVarint();
+                c.count.max = readVarint();
+                c.dataType = readString();
+                c.sizeDistribution = readString();
+                c.memoryBudget = readVarint();
+                c.keyFormat = readString();
+                c.insertionOrder = readString();
+                c.storeDir = readString();
+                c.fileSystem = readString();
+                c.mountOptions = readString();
+                break;
+            }
+            case Record::Type::Sample: {
+                Sample& s = record.sample;
+                s.combination = readVarint();
+                s.op = (trace::Op) file.get();
+                last += chrono::nanoseconds(readVarint());
+                s.timestamp = last;
+                s.keyIndex = readVarint();
+                s.valueSize = readVarint();
+                s.latency = chrono::nanoseconds(readVarint());
+                s.counters.resize(readVarint());
+                for (auto& counter : s.counters)
+                    counter = readVarint();
+                break;
+            }
+            case Record::Type::EngineStats: {
+                EngineStats& e = record.engineStats;
+                e.combination = readVarint();
+                e.op = (trace::Op) file.get();
+                e.stats.clear();
+                for (uint64_t n = readVarint(); n > 0; n--) {
+                    string name = readString();
+                    uint64_t bits = 0;
+                    for (int i = 0; i < 8; i++)
+                        bits |= (uint64_t) (unsigned char) file.get() << (i * 8);
+                    double value;
+                    std::memcpy(&value, &bits, sizeof(value));
+                    e.stats[name] = value;
+                }
+                break;
+            }
+            case Record::Type::Value:
+                record.value.combination = readVarint();
+                record.value.name = readString();
+                record.value.value = readVarint();
+                break;
+            default:
+                throw std::runtime_error("Unknown record type " + std::to_string(type) + " in samples file");
+        }
+        if (!file)
+            throw std::runtime_error("Samples file ends in the middle of a record");
+        return true;
+    }
+}
@@ -0,0 +1,138 @@
+/**
+ * Raw per-sample benchmark output, so distributions can be examined afterwards instead of just the aggregates.
+ *
+ * A samples file starts with the magic "KVSAMPL1" followed by records, each starting with a 1 byte type:
+ * - 'C', a combination the following records refer to: id, hardware, store, size min, size max, count min,
+ *   count max, data type, size distribution, memory budget, key format, insertion order, store dir, file system,
+ *   mount options
+ * - 'S', a timed op: combination id, op (1 byte, see `trace::Op`), timestamp (nanoseconds since the previous
+ *   sample), key index (the i passed to `utils::KeyGenerator`), value size, latency in nanoseconds, the number of
+ *   counters, then each counter
+ * - 'E', engine stats for an op: combination id, op (1 byte), the number of stats, then each stat's name and value
+ *   as 8 byte little endian IEEE double
+ * - 'V', a measurement that isn't an op: combination id, name (e.g. "memory" or "space"), value
+ * Integers are unsigned LEB128 varints and strings are a varint length followed by the bytes.
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <filesystem>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdint>
+
+#include "utils.h"
+#include "trace.h"
+
+namespace samples {
+    /** A benchmark cell the samples belong to */
+    struct Combination {
+        uint64_t id;
+        std::string hardware;
+        std::string store;
+        utils::Range<size_t> size;
+        utils::Range<size_t> count;
+        std::string dataType;
+        std::string sizeDistribution;
+        size_t memoryBudget;
+        /** See `utils::KeyGenerator` */
+        std::string keyFormat;
+        std::string insertionOrder;
+        std::string storeDir;
+        /** The type and mount options of the file system storeDir is on, see `utils::fileSystemInfo` */
+        std::string fileSystem;
+        std::string mountOptions;
+    };
+
+    struct Sample {
+        uint64_t combination;
+        trace::Op op;
+        /** Time since the writer was created */
+        std::chrono::nanoseconds timestamp;
+        uint64_t keyIndex;
+        size_t valueSize;
+        std::chrono::nanoseconds latency;
+        std::vector<uint64_t> counters;
+    };
+
+    struct EngineStats {
+        uint64_t combination;
+        trace::Op op;
+        std::map<std::string, double> stats;
+    };
+
+    struct Value {
+        uint64_t combination;
+        std::string name;
+        uint64_t value;
+    };
+
+    /** A record read from a samples file. Only the member for `type` is filled in. */
+    struct Record {
+        enum class Type : char { Combination = 'C', Sample = 'S', EngineStats = 'E', Value = 'V' };
+        Type type;
+        Combination combination;
+        Sample sample;
+        EngineStats engineStats;
+        Value value;
+    };
+
+    /**
+     * Writes a samples file. Records are buffered in memory and the full buffers are written to the file on a
+     * background thread, so writing a sample is just encoding it.
+     */
+    class SampleWriter {
+        std::ofstream file;
+        std::string buffer;
+        /** A full buffer waiting for the background thread */
+        std::string pending;
+        bool closed = false;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::thread flusher;
+
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds last{0};
+        uint64_t nextCombination = 0;
+
+        /** Hands the buffer to the background thread, waiting if it's still writing the previous one */
+        void handOff();
+
+    public:
+        SampleWriter(const std::filesystem::path& filepath);
+        ~SampleWriter();
+
+        /** Starts a new combination and returns its id. combination.id is ignored. */
+        uint64_t combination(const Combination& combination);
+
+        /** Record an op that just finished, timestamped with the time since the writer was created */
+        void sample(uint64_t combination, trace::Op op, uint64_t keyIndex, size_t valueSize,
+                    std::chrono::nanoseconds latency, const std::vector<uint64_t>& counters = {});
+
+        void engineStats(uint64_t combination, trace::Op op, const std::map<std::string, double>& stats);
+
+        void value(uint64_t combination, const std::string& name, uint64_t value);
+
+        /** Writes everything recorded so far to the file */
+        void flush();
+    };
+
+    /** Streams records from a samples file */
+    class SampleReader {
+        std::ifstream file;
+        std::chrono::nanoseconds last{0};
+
+        uint64_t readVarint();
+        std::string readString();
+
+    public:
+        SampleReader(const std::filesystem::path& filepath);
+
+        /** Reads the next record. Returns false at the end of the file. */
+        bool next(Record& record);
+    };
+}
@@ -3,19 +3,68 @@
 #include <fstream>
 #include <vector>
 #include <utility>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <exception>
+#include <algorithm>
+#include <set>
+#include <cmath>
 
 #include "stores.h"
+#include "utils.h"
 #include "leveldb/write_batch.h"
+#include "rocksdb/statistics.h"
+#include "rocksdb/perf_context.h"
+#include "rocksdb/perf_level.h"
+#include "rocksdb/iostats_context.h"
+#include "rocksdb/merge_operator.h"
 
 namespace stores {
     namespace fs = std::filesystem;
     using fs::path;
     using std::ofstream, std::ifstream;
     using namespace std::string_literals;
-    using std::string, std::to_string, std::vector, std::pair, std::tuple, std::function, std::unique_ptr, std::make_unique;
+    using std::string, std::to_string, std::vector, std::pair, std::tuple, std::function;
+    using std::unique_ptr, std::make_unique;
     using uint = unsigned int;
 
 
+    string fileName(const string& key) {
+        bool safe = !key.empty() && std::all_of(key.begin(), key.end(), [](char c) {
+            return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+        });
+        return safe ? key : utils::toHex(key);
+    }
+
+    /** Splits [0, n) into contiguous chunks and calls fn(begin, end) on each from its own thread */
+    static void parallelFor(size_t n, const function<void(size_t, size_t)>& fn) {
+        size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), n);
+        vector<std::thread> workers;
+        vector<std::exception_ptr> errors(threads);
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&, t]() {
+                try {
+                    fn(n * t / threads, n * (t + 1) / threads);
+                } catch (...) {
+                    errors[t] = std::current_exception();
+                }
+            });
+        }
+        for (auto& worker : workers)
+            worker.join();
+        for (auto& error : errors)
+            if (error) std::rethrow_exception(error);
+    }
+
+
 
     Store::Store(const path& filepath) : filepath(filepath) {};
     
@@ -42,9 +91,44 @@ namespace stores {
         _count += items.size();
     }
 
+    void Store::_readModifyWrite(const string& key, const ModifyFn& fn) {
+        this->_update(key, fn(this->_get(key)));
+    }
+
+    void Store::readModifyWrite(const string& key, const ModifyFn& fn) { this->_readModifyWrite(key, fn); }
+
+    void Store::_append(const string& key, const string& suffix) {
+        this->_readModifyWrite(key, [&](const string& value) { return value + suffix; });
+    }
+
+    void Store::append(const string& key, const string& suffix) { this->_append(key, suffix); }
+
+    void Store::_bulkRemove(const vector<string>& keys) {
+        for (auto& key : keys)
+            this->_remove(key);
+    }
+
+    void Store::bulkRemove(const vector<string>& keys) {
+        this->_bulkRemove(keys);
+        _count -= keys.size();
+    }
+
+    void Store::_removeRange(const vector<string>& keys) { this->_bulkRemove(keys); }
+
+    void Store::removeRange(const vector<string>& keys) {
+        this->_removeRange(keys);
+        _count -= keys.size();
+    }
+
+    std::map<string, double> Store::engineStats() { return {}; }
+
+    void Store::resetEngineStats() {}
+
+    bool Store::threadSafe() { return false; }
 
 
-    SQLite3Store::SQLite3Store(const path& filepath, int flags) : Store(filepath) {
+
+    SQLite3Store::SQLite3Store(const path& filepath, int flags, size_t cacheSize, bool wal) : Store(filepath) {
         fs::remove_all(filepath);
         flags = flags | SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
 
@@ -52,14 +136,25 @@ namespace stores {
         checkStatus(s);
         char* errMmsg = nullptr;
 
+        if (wal) { // has to be set before the first write
+            s = sqlite3_exec(this->db, "PRAGMA journal_mode = WAL", nullptr, 0, &errMmsg);
+            checkStatus(s);
+        }
+
         string sql = 
             "CREATE TABLE IF NOT EXISTS data("
-            "    key TEXT PRIMARY KEY NOT NULL,"
+            "    key BLOB PRIMARY KEY NOT NULL," // keys may be binary
             "    value BLOB NOT NULL"
             ");";
         s = sqlite3_exec(this->db, sql.c_str(), nullptr, 0, &errMmsg);
         checkStatus(s);
 
+        if (cacheSize > 0) {
+            sql = "PRAGMA cache_size = -" + to_string(cacheSize / 1024); // negative sizes are in KiB
+            s = sqlite3_exec(this->db, sql.c_str(), nullptr, 0, &errMmsg);
+            checkStatus(s);
+        }
+
         sql = "INSERT INTO data VALUES (?, ?)";
         s = sqlite3_prepare_v2(this->db, sql.c_str(), sql.length(), &(this->insertStmt), nullptr);
         checkStatus(s);
@@ -75,6 +170,11 @@ namespace stores {
         sql = "DELETE FROM data WHERE key = ?";
         s = sqlite3_prepare_v2(this->db, sql.c_str(), sql.length(), &(this->removeStmt), nullptr);
         checkStatus(s);
+
+        // || returns TEXT, cast it back so get sees the same type as the other ops write
+        sql = "UPDATE data SET value = CAST(value || ? AS BLOB) WHERE key = ?";
+        s = sqlite3_prepare_v2(this->db, sql.c_str(), sql.length(), &(this->appendStmt), nullptr);
+        checkStatus(s);
     }
 
     SQLite3Store::~SQLite3Store() {
@@ -82,6 +182,7 @@ namespace stores {
         sqlite3_finalize(this->updateStmt);
         sqlite3_finalize(this->getStmt);
         sqlite3_finalize(this->removeStmt);
+        sqlite3_finalize(this->appendStmt);
         sqlite3_close(this->db);
     }
 
@@ -93,35 +194,35 @@ namespace stores {
 
     void SQLite3Store::_insert(const string& key, const string& value) {
         // SQLITE_STATIC means that std::string is responsible for the memory of key and value
-        int s = sqlite3_bind_text(this->insertStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
+        int s = sqlite3_bind_blob(this->insertStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
         checkStatus(s);
         s = sqlite3_bind_blob(this->insertStmt, 2, value.c_str(), value.length(), SQLITE_STATIC);
         checkStatus(s);
 
         s = sqlite3_step(this->insertStmt);
-        checkStatus(s);
-        s = sqlite3_reset(this->insertStmt);
+        sqlite3_reset(this->insertStmt); // reset even if the step failed, so the statement can be bound again
         checkStatus(s);
     }
 
     void SQLite3Store::_update(const string& key, const string& value) {
-        int s = sqlite3_bind_text(this->updateStmt, 2, key.c_str(), key.length(), SQLITE_STATIC);
+        int s = sqlite3_bind_blob(this->updateStmt, 2, key.c_str(), key.length(), SQLITE_STATIC);
         checkStatus(s);
         s = sqlite3_bind_blob(this->updateStmt, 1, value.c_str(), value.length(), SQLITE_STATIC);
         checkStatus(s);
 
         s = sqlite3_step(this->updateStmt);
-        checkStatus(s);
-        s = sqlite3_reset(this->updateStmt);
+        sqlite3_reset(this->updateStmt);
         checkStatus(s);
     }
 
     string SQLite3Store::_get(const string& key) {
-        int s = sqlite3_bind_text(this->getStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
+        int s = sqlite3_bind_blob(this->getStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
         checkStatus(s);
         s = sqlite3_step(this->getStmt);
-        if (s == SQLITE_DONE)
+        if (s == SQLITE_DONE) {
+            sqlite3_reset(this->getStmt); // so the statement can be bound again
             throw std::runtime_error("Key not found");
+        }
         checkStatus(s);
 
         const void* valueVoid = sqlite3_column_blob(this->getStmt, 0);
@@ -138,31 +239,96 @@ namespace stores {
     }
 
     void SQLite3Store::_remove(const string& key) {
-        int s = sqlite3_bind_text(this->removeStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
+        int s = sqlite3_bind_blob(this->removeStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
         checkStatus(s);
 
         s = sqlite3_step(this->removeStmt);
+        sqlite3_reset(this->removeStmt);
         checkStatus(s);
-        s = sqlite3_reset(this->removeStmt);
+    }
+
+    void SQLite3Store::_append(const string& key, const string& suffix) {
+        int s = sqlite3_bind_blob(this->appendStmt, 2, key.c_str(), key.length(), SQLITE_STATIC);
+        checkStatus(s);
+        s = sqlite3_bind_blob(this->appendStmt, 1, suffix.c_str(), suffix.length(), SQLITE_STATIC);
         checkStatus(s);
+
+        s = sqlite3_step(this->appendStmt);
+        sqlite3_reset(this->appendStmt);
+        checkStatus(s);
+        if (sqlite3_changes(db) == 0) // the UPDATE didn't match a row
+            throw std::runtime_error("Key not found");
     }
 
-    void SQLite3Store::_bulkInsert(const vector<pair<string, string>>& items) {
-        // Wrapping in a transaction improves bulk insert performance significantly.
-        char* errMessage;
-        int s = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errMessage);
+    void SQLite3Store::transaction(const std::function<void()>& fn) {
+        int s = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, NULL);
         checkStatus(s);
-        for (auto& [key, value] : items)
-            this->_insert(key, value);
-        sqlite3_exec(db, "COMMIT TRANSACTION", NULL, NULL, &errMessage);
+        try {
+            fn();
+        } catch (...) {
+            // Don't leave the transaction open for the next op. SQLite may have already rolled back after some
+            // errors, in which case this fails harmlessly.
+            sqlite3_exec(db, "ROLLBACK TRANSACTION", NULL, NULL, NULL);
+            throw;
+        }
+        s = sqlite3_exec(db, "COMMIT TRANSACTION", NULL, NULL, NULL);
         checkStatus(s);
     }
 
+    void SQLite3Store::_bulkRemove(const vector<string>& keys) {
+        // Old SQLite versions allow at most 999 parameters
+        const size_t batchSize = 500;
+        transaction([&]() {
+            for (size_t i = 0; i < keys.size(); i += batchSize) {
+                size_t count = std::min(batchSize, keys.size() - i);
+                string sql = "DELETE FROM data WHERE key IN (?";
+                for (size_t j = 1; j < count; j++)
+                    sql += ",?";
+                sql += ")";
+
+                sqlite3_stmt* stmt = nullptr;
+                int s = sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, nullptr);
+                checkStatus(s);
+                for (size_t j = 0; j < count; j++)
+                    sqlite3_bind_blob(stmt, j + 1, keys[i + j].c_str(), keys[i + j].length(), SQLITE_STATIC);
+                s = sqlite3_step(stmt);
+                sqlite3_finalize(stmt);
+                checkStatus(s);
+            }
+        });
+    }
 
+    void SQLite3Store::_removeRange(const vector<string>& keys) {
+        if (keys.empty()) return;
+        sqlite3_stmt* stmt = nullptr;
+        string sql = "DELETE FROM data WHERE key BETWEEN ? AND ?";
+        int s = sqlite3_prepare_v2(db, sql.c_str(), sql.length(), &stmt, nullptr);
+        checkStatus(s);
+        sqlite3_bind_blob(stmt, 1, keys.front().c_str(), keys.front().length(), SQLITE_STATIC);
+        sqlite3_bind_blob(stmt, 2, keys.back().c_str(), keys.back().length(), SQLITE_STATIC);
+        s = sqlite3_step(stmt);
+        sqlite3_finalize(stmt);
+        checkStatus(s);
+    }
 
-    LevelDBStore::LevelDBStore(const path& filepath, leveldb::Options options) : Store(filepath) {
+    void SQLite3Store::_bulkInsert(const vector<pair<string, string>>& items) {
+        // Wrapping in a transaction improves bulk insert performance significantly.
+        transaction([&]() {
+            for (auto& [key, value] : items)
+                this->_insert(key, value);
+        });
+    }
+
+
+
+    LevelDBStore::LevelDBStore(const path& filepath, leveldb::Options options, size_t blockCacheSize) :
+        Store(filepath) {
         fs::remove_all(filepath);
         options.create_if_missing = true;
+        if (blockCacheSize > 0) {
+            blockCache.reset(leveldb::NewLRUCache(blockCacheSize));
+            options.block_cache = blockCache.get();
+        }
         
         leveldb::Status status = leveldb::DB::Open(options, filepath, &db);
         checkStatus(status);
@@ -208,13 +374,78 @@ namespace stores {
         checkStatus(s);
     }
 
+    void LevelDBStore::_bulkRemove(const vector<string>& keys) {
+        leveldb::WriteBatch batch;
+        for (auto& key : keys)
+            batch.Delete(key);
+        leveldb::Status s = db->Write(leveldb::WriteOptions(), &batch);
+        checkStatus(s);
+    }
+
+    double LevelDBStore::compactionBytes() {
+        // "leveldb.stats" is a text table with a row per level like
+        //     Level  Files Size(MB) Time(sec) Read(MB) Write(MB)
+        //       0        1        0         0        0         0
+        // LevelDB doesn't expose anything more granular, so this is only accurate to the MB.
+        string stats;
+        if (!db->GetProperty("leveldb.stats", &stats))
+            return 0;
+
+        std::istringstream lines(stats);
+        string line;
+        double totalMB = 0;
+        while (std::getline(lines, line)) {
+            std::istringstream row(line);
+            int level, files;
+            double size, time, read, write;
+            if (row >> level >> files >> size >> time >> read >> write)
+                totalMB += read + write;
+        }
+        return totalMB * 1024 * 1024;
+    }
+
+    std::map<string, double> LevelDBStore::engineStats() {
+        return {{"compaction bytes", compactionBytes() - baseCompactionBytes}};
+    }
+
+    void LevelDBStore::resetEngineStats() {
+        baseCompactionBytes = compactionBytes();
+    }
+
+    bool LevelDBStore::threadSafe() { return true; }
+
+
+    /** Merges by appending the operand to the existing value */
+    class AppendOperator : public rocksdb::AssociativeMergeOperator {
+    public:
+        bool Merge(const rocksdb::Slice&, const rocksdb::Slice* existingValue, const rocksdb::Slice& value,
+                   string* newValue, rocksdb::Logger*) const override {
+            newValue->clear();
+            if (existingValue) {
+                newValue->reserve(existingValue->size() + value.size());
+                newValue->append(existingValue->data(), existingValue->size());
+            }
+            newValue->append(value.data(), value.size());
+            return true;
+        }
+
+        const char* Name() const override { return "AppendOperator"; }
+    };
 
     RocksDBStore::RocksDBStore(const path& filepath, rocksdb::Options options) : Store(filepath) {
         fs::remove_all(filepath);
         options.create_if_missing = true;
-        
+        if (!options.merge_operator)
+            options.merge_operator = std::make_shared<AppendOperator>();
+        if (!options.statistics)
+            options.statistics = rocksdb::CreateDBStatistics();
+        statistics = options.statistics;
+        // The contexts are thread local. Only enable counts, timing every op would skew the measurements.
+        rocksdb::SetPerfLevel(rocksdb::PerfLevel::kEnableCount);
+
         rocksdb::Status status = rocksdb::DB::Open(options, filepath, &db);
         checkStatus(status);
+        resetEngineStats();
     }
 
     RocksDBStore::~RocksDBStore() {
@@ -257,17 +488,110 @@ namespace stores {
         checkStatus(s);
     }
 
+    void RocksDBStore::_bulkRemove(const vector<string>& keys) {
+        rocksdb::WriteBatch batch;
+        for (auto& key : keys)
+            batch.Delete(key);
+        rocksdb::Status s = db->Write(rocksdb::WriteOptions(), &batch);
+        checkStatus(s);
+    }
+
+    void RocksDBStore::_removeRange(const vector<string>& keys) {
+        if (keys.empty()) return;
+        // The end is exclusive. Appending a null byte gives the next key after the last one.
+        rocksdb::Status s = db->DeleteRange(rocksdb::WriteOptions(), db->DefaultColumnFamily(), keys.front(),
+                                            keys.back() + '\0');
+        checkStatus(s);
+    }
+
+    void RocksDBStore::_append(const string& key, const string& suffix) {
+        // Unlike the other stores this doesn't throw on a missing key, Merge just creates it. Checking would cost a
+        // point read per append, which is what the merge operator avoids.
+        rocksdb::Status s = db->Merge(rocksdb::WriteOptions(), key, suffix);
+        checkStatus(s);
+    }
+
+    std::map<string, double> RocksDBStore::engineStats() {
+        auto ticker = [&](rocksdb::Tickers t) { return (double) statistics->getTickerCount(t); };
+
+        std::map<string, double> stats;
+        double cacheAccesses = ticker(rocksdb::BLOCK_CACHE_HIT) + ticker(rocksdb::BLOCK_CACHE_MISS);
+        if (cacheAccesses > 0)
+            stats["block cache hit rate"] = ticker(rocksdb::BLOCK_CACHE_HIT) / cacheAccesses;
+        stats["bloom filter useful"] = ticker(rocksdb::BLOOM_FILTER_USEFUL);
+        stats["memtable hits"] = ticker(rocksdb::MEMTABLE_HIT);
+        stats["compaction bytes"] = ticker(rocksdb::COMPACT_READ_BYTES) + ticker(rocksdb::COMPACT_WRITE_BYTES);
+        stats["write stall micros"] = ticker(rocksdb::STALL_MICROS);
+        stats["block reads"] = rocksdb::get_perf_context()->block_read_count;
+        stats["bytes read"] = rocksdb::get_iostats_context()->bytes_read;
+        stats["bytes written"] = rocksdb::get_iostats_context()->bytes_written;
+        return stats;
+    }
+
+    void RocksDBStore::resetEngineStats() {
+        statistics->Reset();
+        rocksdb::get_perf_context()->Reset();
+        rocksdb::get_iostats_context()->Reset();
+    }
+
+    bool RocksDBStore::threadSafe() { return true; }
+
+
+    /** Sets the cache size of a Db or DbEnv */
+    template<typename Handle>
+    static void setCacheSize(Handle& handle, size_t cacheSize) {
+        const size_t GiB = 1024 * 1024 * 1024; // set_cachesize takes the size split into GiB and bytes
+        int s = handle.set_cachesize(cacheSize / GiB, cacheSize % GiB, 1);
+        if (s != 0)
+            throw std::runtime_error(std::to_string(s));
+    }
 
-    BerkeleyDBStore::BerkeleyDBStore(const path& filepath, DBTYPE dbtype, u_int32_t flags) : Store(filepath), db(NULL, 0) {
+    BerkeleyDBStore::BerkeleyDBStore(const path& filepath, DBTYPE dbtype, u_int32_t flags, size_t cacheSize) :
+        Store(filepath), db(NULL, 0), dbtype(dbtype) {
         fs::remove_all(filepath);
         flags = flags | DB_CREATE;
+        if (cacheSize > 0)
+            setCacheSize(db, cacheSize);
         
         int s = db.open(NULL, filepath.c_str(), NULL, dbtype, flags, 0);
         checkStatus(s);
     }
 
+    BerkeleyDBStore::BerkeleyDBStore(const path& filepath, const BerkeleyDBEnvOptions& envOptions, DBTYPE dbtype) :
+        Store(filepath), env(make_unique<DbEnv>(0)), db(env.get(), 0), dbtype(dbtype), threaded(envOptions.threaded),
+        transactional(envOptions.transactional) {
+        fs::remove_all(filepath);
+        fs::create_directories(filepath);
+
+        // DB_PRIVATE keeps the environment regions in process memory rather than files in the home, so they don't
+        // count toward the store's disk usage.
+        u_int32_t envFlags = DB_CREATE|DB_INIT_MPOOL|DB_PRIVATE;
+        u_int32_t dbFlags = DB_CREATE;
+        if (envOptions.transactional) {
+            envFlags |= DB_INIT_LOCK|DB_INIT_LOG|DB_INIT_TXN;
+            dbFlags |= DB_AUTO_COMMIT;
+            // Write the log on commit but don't fsync it, like the other stores
+            checkStatus(env->set_flags(DB_TXN_WRITE_NOSYNC, 1));
+        }
+        if (envOptions.threaded) {
+            envFlags |= DB_THREAD|DB_INIT_LOCK;
+            dbFlags |= DB_THREAD;
+        }
+        if (envFlags & DB_INIT_LOCK)
+            checkStatus(env->set_lk_detect(DB_LOCK_DEFAULT)); // abort one side of a deadlock instead of hanging
+        if (envOptions.cacheSize > 0)
+            setCacheSize(*env, envOptions.cacheSize);
+        checkStatus(env->open(filepath.c_str(), envFlags, 0));
+
+        if (envOptions.pageSize > 0)
+            checkStatus(db.set_pagesize(envOptions.pageSize));
+        checkStatus(db.open(NULL, "data.db", NULL, dbtype, dbFlags, 0));
+    }
+
     BerkeleyDBStore::~BerkeleyDBStore() {
         int s = db.close(0);
+        if (env)
+            env->close(0);
         checkStatus(s);
     }
 
@@ -296,10 +620,15 @@ namespace stores {
     string BerkeleyDBStore::_get(const string& key) {
         Dbt keyDbt = makeDbt(key);
         Dbt valueDbt;
+        if (threaded) // Db owns the default buffer, which isn't safe to share between threads
+            valueDbt.set_flags(DB_DBT_MALLOC);
         int s = db.get(NULL, &keyDbt, &valueDbt, 0);
         checkStatus(s);
         // Note: this is a copy. See the SQLite get as well.
-        return string((char*) valueDbt.get_data(), valueDbt.get_size());
+        string value((char*) valueDbt.get_data(), valueDbt.get_size());
+        if (threaded)
+            std::free(valueDbt.get_data());
+        return value;
     }
 
     void BerkeleyDBStore::_remove(const string& key) {
@@ -307,6 +636,84 @@ namespace stores {
         db.del(NULL, &keyDbt, 0);
     }
 
+    void BerkeleyDBStore::_readModifyWrite(const string& key, const ModifyFn& fn) {
+        // Cursor writes in a transactional database have to be in an explicit transaction
+        DbTxn* txn = nullptr;
+        if (transactional)
+            checkStatus(env->txn_begin(NULL, &txn, 0));
+        Dbc* cursor = nullptr;
+        try {
+            checkStatus(db.cursor(txn, &cursor, 0));
+            Dbt keyDbt = makeDbt(key);
+            Dbt valueDbt;
+            if (threaded)
+                valueDbt.set_flags(DB_DBT_MALLOC);
+            // DB_RMW takes the write lock up front so a concurrent rmw can't deadlock upgrading its read lock
+            bool locking = transactional || threaded;
+            checkStatus(cursor->get(&keyDbt, &valueDbt, DB_SET | (locking ? DB_RMW : 0)));
+            string value((char*) valueDbt.get_data(), valueDbt.get_size());
+            if (threaded)
+                std::free(valueDbt.get_data());
+
+            string newValue = fn(value);
+            Dbt newValueDbt = makeDbt(newValue);
+            checkStatus(cursor->put(&keyDbt, &newValueDbt, DB_CURRENT));
+            checkStatus(cursor->close());
+            cursor = nullptr;
+            if (txn)
+                checkStatus(txn->commit(0));
+        } catch (...) {
+            if (cursor) cursor->close();
+            if (txn) txn->abort();
+            throw;
+        }
+    }
+
+    void BerkeleyDBStore::_removeRange(const vector<string>& keys) {
+        if (dbtype != DB_BTREE || keys.empty())
+            return Store::_removeRange(keys);
+
+        DbTxn* txn = nullptr;
+        if (transactional)
+            checkStatus(env->txn_begin(NULL, &txn, 0));
+        Dbc* cursor = nullptr;
+        try {
+            checkStatus(db.cursor(txn, &cursor, 0));
+            Dbt keyDbt = makeDbt(keys.front());
+            Dbt valueDbt; // Only read the keys
+            valueDbt.set_flags(DB_DBT_PARTIAL | (threaded ? DB_DBT_MALLOC : 0));
+            valueDbt.set_doff(0);
+            valueDbt.set_dlen(0);
+            if (threaded)
+                keyDbt.set_flags(DB_DBT_MALLOC);
+
+            int s = cursor->get(&keyDbt, &valueDbt, DB_SET_RANGE);
+            while (s == 0) {
+                string key((char*) keyDbt.get_data(), keyDbt.get_size());
+                if (threaded) {
+                    std::free(keyDbt.get_data());
+                    std::free(valueDbt.get_data());
+                }
+                if (key > keys.back())
+                    break;
+                checkStatus(cursor->del(0));
+                s = cursor->get(&keyDbt, &valueDbt, DB_NEXT);
+            }
+            if (s != 0 && s != DB_NOTFOUND)
+                checkStatus(s);
+            checkStatus(cursor->close());
+            cursor = nullptr;
+            if (txn)
+                checkStatus(txn->commit(0));
+        } catch (...) {
+            if (cursor) cursor->close();
+            if (txn) txn->abort();
+            throw;
+        }
+    }
+
+    bool BerkeleyDBStore::threadSafe() { return threaded; }
+
 
 
     FlatFolderStore::FlatFolderStore(const path& filepath) : Store(filepath) {
@@ -315,7 +722,7 @@ namespace stores {
     }
 
     path FlatFolderStore::getPath(const string& key) {
-        return filepath / key;
+        return filepath / fileName(key);
     }
 
     void FlatFolderStore::_insert(const string& key, const string& value) {
@@ -346,6 +753,67 @@ namespace stores {
         fs::remove(getPath(key));
     }
 
+    void FlatFolderStore::_bulkRemove(const vector<string>& keys) {
+        parallelFor(keys.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                fs::remove(getPath(keys[i]));
+        });
+    }
+
+    /** Throws a runtime_error with the message for errno */
+    static void throwErrno(const string& message) {
+        throw std::runtime_error(message + ": " + std::strerror(errno));
+    }
+
+    /** Writes all of data to fd at offset, retrying short writes */
+    static void writeAll(int fd, const char* data, size_t size, off_t offset = 0) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = pwrite(fd, data + written, size - written, offset + written);
+            if (n < 0 && errno != EINTR)
+                throwErrno("write failed");
+            if (n > 0) written += n;
+        }
+    }
+
+    static size_t fileSize(int fd) {
+        struct stat info;
+        if (fstat(fd, &info) != 0)
+            throwErrno("stat failed");
+        return info.st_size;
+    }
+
+    /** Writes all of data to the current position of fd (the end if it's O_APPEND), retrying short writes */
+    static void appendAll(int fd, const char* data, size_t size) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = write(fd, data + written, size - written);
+            if (n < 0 && errno != EINTR)
+                throwErrno("write failed");
+            if (n > 0) written += n;
+        }
+    }
+
+    /** Appends suffix to the existing file for key with O_APPEND, throwing like `Store::_append` if there isn't one */
+    static void appendToFile(const path& filePath, const string& key, const string& suffix) {
+        int fd = open(filePath.c_str(), O_WRONLY|O_APPEND|O_CLOEXEC); // no O_CREAT, so missing keys fail
+        if (fd < 0)
+            throw std::runtime_error("Key \""s + key + "\" doesn't exit");
+        try {
+            appendAll(fd, suffix.data(), suffix.size());
+        } catch (...) {
+            close(fd);
+            throw;
+        }
+        close(fd);
+    }
+
+    void FlatFolderStore::_append(const string& key, const string& suffix) {
+        appendToFile(getPath(key), key, suffix);
+    }
+
+    bool FlatFolderStore::threadSafe() { return true; }
+
 
 
     NestedFolderStore::NestedFolderStore(const path& filepath, uint charsPerLevel, uint depth, size_t keyLen) :
@@ -357,17 +825,42 @@ namespace stores {
         fs::create_directories(filepath);
     }
 
-    path NestedFolderStore::getPath(const string& key) {
-        if (key.size() != keyLen)
-            throw std::runtime_error("Key \"" + key + "\" not of size " + to_string(keyLen));
+    pair<uint, uint> NestedFolderStore::autoLayout(size_t count, size_t filesPerDir, size_t keyLen) {
+        // Each hex character of prefix divides the files between 16 directories. Round in log space so the leaf
+        // directories end up as close to filesPerDir as possible.
+        double chars = std::round(std::log(std::max<double>(count, 1) / filesPerDir) / std::log(16));
+        uint prefixChars = std::min<uint>(std::max(chars, 0.0), keyLen - 1);
+        if (prefixChars == 0)
+            return {1, 1};
+
+        // Use as few levels as we can without any level having more than filesPerDir subdirectories. Every level
+        // has the same width, so it has to divide prefixChars or the prefix would be longer than we picked.
+        uint maxCharsPerLevel = 1;
+        while (std::pow(16, maxCharsPerLevel + 1) <= filesPerDir)
+            maxCharsPerLevel++;
+        uint charsPerLevel = std::min(maxCharsPerLevel, prefixChars);
+        while (prefixChars % charsPerLevel != 0)
+            charsPerLevel--;
+        return {charsPerLevel, prefixChars / charsPerLevel + 1};
+    }
+
+    string NestedFolderStore::keyName(const string& key) {
+        string name = fileName(key);
+        if (name.size() > keyLen)
+            throw std::runtime_error("Key \"" + name + "\" longer than " + to_string(keyLen));
+        name.resize(keyLen, '_'); // '_' isn't used by fileName, so padded names can't collide
+        return name;
+    }
 
+    path NestedFolderStore::getPath(const string& key) {
+        string name = keyName(key);
         path recordPath(filepath);
         uint i = 0;
         for (; i < (depth - 1) * charsPerLevel; i += charsPerLevel) {
-            recordPath /= key.substr(i, charsPerLevel); // substr does bounds check
+            recordPath /= name.substr(i, charsPerLevel); // substr does bounds check
         }
-        if (i < key.size()) {
-            recordPath /= key.substr(i, string::npos);
+        if (i < name.size()) {
+            recordPath /= name.substr(i, string::npos);
         }
 
         return recordPath;
@@ -400,7 +893,705 @@ namespace stores {
     }
 
     void NestedFolderStore::_remove(const string& key) {
-        // TODO potential improvement, delete empty directories
+        // Leaves empty directories behind, NestedFolderFdStore removes them
         fs::remove(getPath(key));
     }
+
+    void NestedFolderStore::_bulkRemove(const vector<string>& keys) {
+        parallelFor(keys.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                fs::remove(getPath(keys[i]));
+        });
+
+        // Remove the directories that are now empty, deepest first
+        vector<std::set<path>> dirsByLevel(depth);
+        for (auto& key : keys) {
+            path dir = getPath(key).parent_path();
+            for (uint level = depth - 1; level > 0; level--) {
+                dirsByLevel[level].insert(dir);
+                dir = dir.parent_path();
+            }
+        }
+        for (uint level = depth - 1; level > 0; level--) {
+            vector<path> dirs(dirsByLevel[level].begin(), dirsByLevel[level].end());
+            parallelFor(dirs.size(), [&](size_t begin, size_t end) {
+                std::error_code error; // ignore directories that aren't empty
+                for (size_t i = begin; i < end; i++)
+                    fs::remove(dirs[i], error);
+            });
+        }
+    }
+
+    void NestedFolderStore::_append(const string& key, const string& suffix) {
+        appendToFile(getPath(key), key, suffix);
+    }
+
+    bool NestedFolderStore::threadSafe() { return true; }
+
+
+
+    /** Reads the whole file at fd, which is expected to be size bytes */
+    static string readAll(int fd, size_t size) {
+        string value(size, '\0');
+        size_t read = 0;
+        while (read < value.size()) {
+            ssize_t n = pread(fd, &value[read], value.size() - read, read);
+            if (n < 0 && errno != EINTR)
+                throwErrno("read failed");
+            if (n == 0) break; // file shrunk
+            if (n > 0) read += n;
+        }
+        value.resize(read);
+        return value;
+    }
+
+    NestedFolderFdStore::NestedFolderFdStore(const path& filepath, uint charsPerLevel, uint depth, size_t keyLen,
+                                             size_t maxOpenDirs) :
+        NestedFolderStore(filepath, charsPerLevel, depth, keyLen),
+        maxOpenDirs(std::max<size_t>(maxOpenDirs, this->depth)) {
+        if (keyLen > NAME_MAX)
+            throw std::runtime_error("Keys longer than " + to_string(NAME_MAX) + " aren't supported");
+        rootFd = open(filepath.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (rootFd < 0)
+            throwErrno("Couldn't open " + filepath.native());
+    }
+
+    NestedFolderFdStore::~NestedFolderFdStore() {
+        for (auto& [prefix, fd] : openDirs)
+            close(fd);
+        close(rootFd);
+    }
+
+    void NestedFolderFdStore::getName(const string& key, uint level, char* buffer) {
+        size_t start = (level - 1) * charsPerLevel;
+        size_t len = level < depth ? charsPerLevel : key.size() - start;
+        std::memcpy(buffer, key.data() + start, len);
+        buffer[len] = '\0';
+    }
+
+    int NestedFolderFdStore::getDir(const string& key, uint level, bool create) {
+        if (level == 0)
+            return rootFd;
+
+        string prefix = key.substr(0, level * charsPerLevel); // short enough for the small string optimization
+        auto cached = openDirsIndex.find(prefix);
+        if (cached != openDirsIndex.end()) {
+            openDirs.splice(openDirs.begin(), openDirs, cached->second); // move to front
+            return cached->second->second;
+        }
+
+        int parentFd = getDir(key, level - 1, create);
+        if (parentFd < 0)
+            return -1;
+
+        char name[NAME_MAX + 1];
+        getName(key, level, name);
+        int fd = openat(parentFd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT && create) {
+            if (mkdirat(parentFd, name, 0755) != 0 && errno != EEXIST)
+                throwErrno("Couldn't create directory for key \"" + key + "\"");
+            fd = openat(parentFd, name, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        }
+        if (fd < 0) {
+            if (errno == ENOENT) return -1;
+            throwErrno("Couldn't open directory for key \"" + key + "\"");
+        }
+
+        openDirs.push_front({prefix, fd});
+        openDirsIndex[prefix] = openDirs.begin();
+        if (openDirs.size() > maxOpenDirs) // parent dirs were just used, so they won't be evicted
+            forgetDir(openDirs.back().first);
+        return fd;
+    }
+
+    void NestedFolderFdStore::forgetDir(const string& prefix) {
+        auto cached = openDirsIndex.find(prefix);
+        if (cached != openDirsIndex.end()) {
+            close(cached->second->second);
+            openDirs.erase(cached->second);
+            openDirsIndex.erase(cached);
+        }
+    }
+
+    void NestedFolderFdStore::_insert(const string& key, const string& value) {
+        string keyPath = keyName(key);
+        int dirFd = getDir(keyPath, depth - 1, true);
+        char name[NAME_MAX + 1];
+        getName(keyPath, depth, name);
+
+        int fd = openat(dirFd, name, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+        if (fd < 0)
+            throwErrno("Couldn't write key \"" + key + "\"");
+        writeAll(fd, value.data(), value.size());
+        close(fd);
+    }
+
+    void NestedFolderFdStore::_update(const string& key, const string& value) {
+        _insert(key, value);
+    }
+
+    string NestedFolderFdStore::_get(const string& key) {
+        string keyPath = keyName(key);
+        int dirFd = getDir(keyPath, depth - 1, false);
+        char name[NAME_MAX + 1];
+        int fd = -1;
+        if (dirFd >= 0) {
+            getName(keyPath, depth, name);
+            fd = openat(dirFd, name, O_RDONLY|O_CLOEXEC);
+        }
+        if (fd < 0)
+            throw std::runtime_error("Key \""s + key + "\" doesn't exit");
+        string value = readAll(fd, fileSize(fd));
+        close(fd);
+        return value;
+    }
+
+    void NestedFolderFdStore::_remove(const string& key) {
+        string keyPath = keyName(key);
+        int dirFd = getDir(keyPath, depth - 1, false);
+        if (dirFd < 0)
+            return;
+        char name[NAME_MAX + 1];
+        getName(keyPath, depth, name);
+        unlinkat(dirFd, name, 0);
+
+        // Remove directories that are now empty, stopping at the first one that isn't
+        for (uint level = depth - 1; level > 0; level--) {
+            int parentFd = getDir(keyPath, level - 1, false);
+            getName(keyPath, level, name);
+            if (unlinkat(parentFd, name, AT_REMOVEDIR) != 0)
+                break; // ENOTEMPTY
+            forgetDir(keyPath.substr(0, level * charsPerLevel));
+        }
+    }
+
+    void NestedFolderFdStore::_bulkRemove(const vector<string>& keys) {
+        for (auto& key : keys)
+            _remove(key);
+    }
+
+    void NestedFolderFdStore::_append(const string& key, const string& suffix) {
+        string keyPath = keyName(key);
+        int dirFd = getDir(keyPath, depth - 1, false);
+        char name[NAME_MAX + 1];
+        int fd = -1;
+        if (dirFd >= 0) {
+            getName(keyPath, depth, name);
+            fd = openat(dirFd, name, O_WRONLY|O_APPEND|O_CLOEXEC);
+        }
+        if (fd < 0)
+            throw std::runtime_error("Key \""s + key + "\" doesn't exit");
+        appendAll(fd, suffix.data(), suffix.size());
+        close(fd);
+    }
+
+    bool NestedFolderFdStore::threadSafe() { return false; } // The directory cache isn't synchronized
+
+
+    ReshardingFolderStore::ReshardingFolderStore(const path& filepath, uint charsPerLevel, size_t maxFilesPerDir,
+                                                 size_t keyLen) :
+        NestedFolderStore(filepath, charsPerLevel, 1, keyLen), maxFilesPerDir(maxFilesPerDir) {}
+
+    string ReshardingFolderStore::leafPrefix(const string& name) {
+        size_t len = 0;
+        while (splitDirs.count(name.substr(0, len)))
+            len += charsPerLevel;
+        return name.substr(0, len);
+    }
+
+    path ReshardingFolderStore::prefixPath(const string& prefix) {
+        path dirPath(filepath);
+        for (size_t i = 0; i < prefix.size(); i += charsPerLevel)
+            dirPath /= prefix.substr(i, charsPerLevel);
+        return dirPath;
+    }
+
+    path ReshardingFolderStore::getPath(const string& key) {
+        string name = keyName(key);
+        string prefix = leafPrefix(name);
+        return prefixPath(prefix) / name.substr(prefix.size());
+    }
+
+    void ReshardingFolderStore::split(const string& prefix) {
+        path dir = prefixPath(prefix);
+        vector<string> names; // list first so we don't iterate over the new subdirectories
+        for (auto& entry : fs::directory_iterator(dir))
+            names.push_back(entry.path().filename());
+
+        splitDirs.insert(prefix);
+        fileCounts.erase(prefix);
+        splits++;
+        vector<string> children;
+        for (auto& name : names) {
+            string child = name.substr(0, charsPerLevel);
+            if (fileCounts[prefix + child]++ == 0) {
+                fs::create_directory(dir / child);
+                children.push_back(prefix + child);
+            }
+            fs::rename(dir / name, dir / child / name.substr(charsPerLevel));
+            filesMoved++;
+        }
+
+        // Skewed keys could overflow a child too
+        for (auto& child : children)
+            if (fileCounts[child] > maxFilesPerDir && child.size() + charsPerLevel < keyLen)
+                split(child);
+    }
+
+    void ReshardingFolderStore::_insert(const string& key, const string& value) {
+        string prefix = leafPrefix(keyName(key));
+        NestedFolderStore::_insert(key, value);
+        if (++fileCounts[prefix] > maxFilesPerDir && prefix.size() + charsPerLevel < keyLen)
+            split(prefix);
+    }
+
+    void ReshardingFolderStore::_update(const string& key, const string& value) {
+        NestedFolderStore::_insert(key, value); // doesn't change the file counts
+    }
+
+    void ReshardingFolderStore::_remove(const string& key) {
+        string name = keyName(key);
+        string prefix = leafPrefix(name);
+        if (fs::remove(prefixPath(prefix) / name.substr(prefix.size())))
+            fileCounts[prefix]--;
+    }
+
+    void ReshardingFolderStore::_bulkRemove(const vector<string>& keys) {
+        for (auto& key : keys)
+            _remove(key);
+    }
+
+    std::map<string, double> ReshardingFolderStore::engineStats() {
+        return {{"directory splits", splits}, {"files moved", filesMoved}};
+    }
+
+    void ReshardingFolderStore::resetEngineStats() {
+        splits = 0;
+        filesMoved = 0;
+    }
+
+    bool ReshardingFolderStore::threadSafe() { return false; }
+
+
+    /** Closes the file descriptor when it goes out of scope */
+    struct ScopedFd {
+        int fd;
+        ScopedFd(int fd) : fd(fd) {}
+        ScopedFd(const ScopedFd&) = delete;
+        ~ScopedFd() { if (fd >= 0) close(fd); }
+    };
+
+    /** O_DIRECT needs buffers, sizes, and offsets aligned to the logical block size. 4 KiB covers most devices. */
+    const size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    static unique_ptr<char, decltype(&std::free)> alignedBuffer(size_t size) {
+        char* buffer = (char*) std::aligned_alloc(DIRECT_IO_ALIGNMENT, size);
+        if (!buffer)
+            throw std::bad_alloc();
+        return {buffer, &std::free};
+    }
+
+    static size_t alignUp(size_t size) {
+        return (size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    }
+
+    PosixFileStore::PosixFileStore(const path& filepath, bool preallocate, bool atomicReplace, size_t directMinSize) :
+        Store(filepath), preallocate(preallocate), atomicReplace(atomicReplace), directMinSize(directMinSize) {
+        fs::remove_all(filepath);
+        fs::create_directories(filepath);
+        dirFd = open(filepath.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+        if (dirFd < 0)
+            throwErrno("Couldn't open " + filepath.native());
+    }
+
+    PosixFileStore::~PosixFileStore() {
+        close(dirFd);
+    }
+
+    int PosixFileStore::openForWrite(const char* name, int flags, size_t size, bool& direct) {
+        flags |= O_WRONLY|O_CLOEXEC;
+        direct = directMinSize > 0 && size >= directMinSize;
+        int fd = openat(dirFd, name, flags|(direct ? O_DIRECT : 0), 0644);
+        if (fd < 0 && direct && errno == EINVAL) { // file system doesn't support O_DIRECT
+            direct = false;
+            fd = openat(dirFd, name, flags, 0644);
+        }
+        return fd;
+    }
+
+    void PosixFileStore::writeFile(int fd, const string& value, bool direct) {
+        if (preallocate && !value.empty() && fallocate(fd, 0, 0, value.size()) != 0 && errno != EOPNOTSUPP)
+            throwErrno("fallocate failed");
+
+        if (direct) {
+            // Write whole blocks from an aligned copy, then trim the padding
+            size_t size = alignUp(value.size());
+            auto buffer = alignedBuffer(size);
+            std::memcpy(buffer.get(), value.data(), value.size());
+            std::memset(buffer.get() + value.size(), 0, size - value.size());
+            writeAll(fd, buffer.get(), size);
+            if (ftruncate(fd, value.size()) != 0)
+                throwErrno("truncate failed");
+        } else {
+            writeAll(fd, value.data(), value.size());
+        }
+    }
+
+    void PosixFileStore::writeInPlace(const string& key, const string& value) {
+        bool direct;
+        ScopedFd file(openForWrite(fileName(key).c_str(), O_CREAT|O_TRUNC, value.size(), direct));
+        if (file.fd < 0)
+            throwErrno("Couldn't write key \"" + key + "\"");
+        writeFile(file.fd, value, direct);
+    }
+
+    void PosixFileStore::replace(const string& key, const string& value) {
+        // File names are letters and digits, so they won't collide with the temporary names
+        string tmpName = ".tmp" + to_string(tmpFileCounter++);
+        bool direct;
+        {
+            ScopedFd file(openForWrite(tmpName.c_str(), O_CREAT|O_EXCL, value.size(), direct));
+            if (file.fd < 0)
+                throwErrno("Couldn't write key \"" + key + "\"");
+            try {
+                writeFile(file.fd, value, direct);
+            } catch (...) {
+                unlinkat(dirFd, tmpName.c_str(), 0);
+                throw;
+            }
+        }
+        if (renameat(dirFd, tmpName.c_str(), dirFd, fileName(key).c_str()) != 0) {
+            unlinkat(dirFd, tmpName.c_str(), 0);
+            throwErrno("Couldn't write key \"" + key + "\"");
+        }
+    }
+
+    void PosixFileStore::_insert(const string& key, const string& value) {
+        if (!atomicReplace)
+            return writeInPlace(key, value);
+
+        if (tmpFileSupported) {
+            bool direct;
+            ScopedFd file(openForWrite(".", O_TMPFILE, value.size(), direct));
+            if (file.fd >= 0) {
+                writeFile(file.fd, value, direct);
+                // Linking by fd needs CAP_DAC_READ_SEARCH, but linking the /proc path doesn't
+                char procPath[32];
+                std::snprintf(procPath, sizeof(procPath), "/proc/self/fd/%d", file.fd);
+                if (linkat(AT_FDCWD, procPath, dirFd, fileName(key).c_str(), AT_SYMLINK_FOLLOW) == 0)
+                    return;
+                if (errno == ENOENT) // no /proc
+                    tmpFileSupported = false;
+                else if (errno != EEXIST) // if the key already exists, replace it below
+                    throwErrno("Couldn't write key \"" + key + "\"");
+            } else if (errno == EOPNOTSUPP || errno == EISDIR) { // file system or kernel doesn't support O_TMPFILE
+                tmpFileSupported = false;
+            } else {
+                throwErrno("Couldn't write key \"" + key + "\"");
+            }
+        }
+        replace(key, value);
+    }
+
+    void PosixFileStore::_update(const string& key, const string& value) {
+        if (atomicReplace) {
+            replace(key, value);
+        } else {
+            writeInPlace(key, value);
+        }
+    }
+
+    string PosixFileStore::_get(const string& key) {
+        ScopedFd file(openat(dirFd, fileName(key).c_str(), O_RDONLY|O_CLOEXEC));
+        if (file.fd < 0)
+            throw std::runtime_error("Key \""s + key + "\" doesn't exit");
+        size_t size = fileSize(file.fd);
+
+        bool direct = directMinSize > 0 && size >= directMinSize;
+        if (direct && fcntl(file.fd, F_SETFL, fcntl(file.fd, F_GETFL)|O_DIRECT) == 0) {
+            size_t alignedSize = alignUp(size);
+            auto buffer = alignedBuffer(alignedSize);
+            size_t read = 0;
+            while (read < size) { // the last block will be a short read
+                ssize_t n = pread(file.fd, buffer.get() + read, alignedSize - read, read);
+                if (n < 0 && errno != EINTR)
+                    throwErrno("read failed");
+                if (n == 0) break; // end of file
+                if (n > 0) read += n;
+            }
+            return string(buffer.get(), std::min(read, size));
+        }
+        return readAll(file.fd, size);
+    }
+
+    void PosixFileStore::_remove(const string& key) {
+        if (unlinkat(dirFd, fileName(key).c_str(), 0) != 0 && errno != ENOENT)
+            throwErrno("Couldn't remove key \"" + key + "\"");
+    }
+
+    void PosixFileStore::_bulkRemove(const vector<string>& keys) {
+        parallelFor(keys.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++)
+                _remove(keys[i]);
+        });
+    }
+
+    void PosixFileStore::_append(const string& key, const string& suffix) {
+        ScopedFd file(openat(dirFd, fileName(key).c_str(), O_WRONLY|O_APPEND|O_CLOEXEC));
+        if (file.fd < 0)
+            throw std::runtime_error("Key \""s + key + "\" doesn't exit");
+        appendAll(file.fd, suffix.data(), suffix.size());
+    }
+
+    bool PosixFileStore::threadSafe() { return true; }
+
+
+    /** Prefixes of the values HybridStore stores in its database */
+    const char INLINE_RECORD = 'i', FILE_RECORD = 'f';
+
+    HybridStore::HybridStore(const path& filepath, function<unique_ptr<Store>(const path&)> makeDb, size_t threshold,
+                             uint charsPerLevel, uint depth, size_t keyLen) :
+        Store(filepath), threshold(threshold) {
+        fs::remove_all(filepath);
+        fs::create_directories(filepath);
+        db = makeDb(filepath / "db");
+        files = make_unique<NestedFolderStore>(filepath / "files", charsPerLevel, depth, keyLen);
+    }
+
+    bool HybridStore::inFile(const string& dbValue) {
+        return !dbValue.empty() && dbValue[0] == FILE_RECORD;
+    }
+
+    void HybridStore::_insert(const string& key, const string& value) {
+        if (value.size() >= threshold) {
+            files->insert(key, value);
+            db->insert(key, string(1, FILE_RECORD));
+        } else {
+            db->insert(key, INLINE_RECORD + value);
+        }
+    }
+
+    void HybridStore::_update(const string& key, const string& value) {
+        bool wasInFile = inFile(db->get(key));
+        if (value.size() >= threshold) {
+            files->update(key, value);
+            if (!wasInFile)
+                db->update(key, string(1, FILE_RECORD));
+        } else {
+            db->update(key, INLINE_RECORD + value);
+            if (wasInFile)
+                files->remove(key);
+        }
+    }
+
+    string HybridStore::_get(const string& key) {
+        string value = db->get(key);
+        if (inFile(value))
+            return files->get(key);
+        value.erase(0, 1);
+        return value;
+    }
+
+    void HybridStore::_remove(const string& key) {
+        string value;
+        try {
+            value = db->get(key);
+        } catch (const std::runtime_error&) {
+            return; // doesn't exist
+        }
+        db->remove(key);
+        if (inFile(value))
+            files->remove(key);
+    }
+
+    void HybridStore::_bulkInsert(const vector<pair<string, string>>& items) {
+        vector<pair<string, string>> dbItems;
+        dbItems.reserve(items.size());
+        for (auto& [key, value] : items) {
+            if (value.size() >= threshold) {
+                files->insert(key, value);
+                dbItems.push_back({key, string(1, FILE_RECORD)});
+            } else {
+                dbItems.push_back({key, INLINE_RECORD + value});
+            }
+        }
+        db->bulkInsert(dbItems);
+    }
+
+    void HybridStore::_bulkRemove(const vector<string>& keys) {
+        vector<string> fileKeys;
+        for (auto& key : keys)
+            if (inFile(db->get(key)))
+                fileKeys.push_back(key);
+        db->bulkRemove(keys);
+        files->bulkRemove(fileKeys);
+    }
+
+    void HybridStore::_removeRange(const vector<string>& keys) {
+        vector<string> fileKeys;
+        for (auto& key : keys)
+            if (inFile(db->get(key)))
+                fileKeys.push_back(key);
+        db->removeRange(keys);
+        files->bulkRemove(fileKeys);
+    }
+
+    std::map<string, double> HybridStore::engineStats() { return db->engineStats(); }
+
+    void HybridStore::resetEngineStats() { db->resetEngineStats(); }
+
+    bool HybridStore::threadSafe() { return db->threadSafe() && files->threadSafe(); }
+
+
+    static void checkSQLiteStatus(int status) {
+        if (status != SQLITE_OK && status != SQLITE_ROW && status != SQLITE_DONE)
+            throw std::runtime_error("SQLite error: " + std::to_string(status));
+    }
+
+    /** Ids for SQLite3PoolStore */
+    static std::atomic<uint64_t> nextPoolId = 0;
+
+    SQLite3PoolStore::Reader::~Reader() {
+        sqlite3_finalize(getStmt);
+        sqlite3_close(db);
+    }
+
+    SQLite3PoolStore::SQLite3PoolStore(const path& filepath, size_t cacheSize) :
+        Store(filepath), cacheSize(cacheSize), id(nextPoolId++) {
+        writer = make_unique<SQLite3Store>(filepath, 0, cacheSize, true);
+    }
+
+    SQLite3PoolStore::~SQLite3PoolStore() {
+        readers.clear(); // close the readers before the writer checkpoints the log
+        writer.reset();
+    }
+
+    SQLite3PoolStore::Reader& SQLite3PoolStore::reader() {
+        thread_local std::unordered_map<uint64_t, Reader*> threadReaders;
+        auto it = threadReaders.find(id);
+        if (it != threadReaders.end())
+            return *it->second;
+
+        auto reader = make_unique<Reader>();
+        // NOMUTEX as only this thread uses the connection
+        int s = sqlite3_open_v2(filepath.c_str(), &reader->db, SQLITE_OPEN_READONLY|SQLITE_OPEN_NOMUTEX, NULL);
+        checkSQLiteStatus(s);
+        sqlite3_busy_timeout(reader->db, 1000); // e.g. while the writer resets the log
+        if (cacheSize > 0) {
+            string sql = "PRAGMA cache_size = -" + to_string(cacheSize / 1024);
+            s = sqlite3_exec(reader->db, sql.c_str(), nullptr, 0, nullptr);
+            checkSQLiteStatus(s);
+        }
+        string sql = "SELECT value FROM data WHERE key = ?";
+        s = sqlite3_prepare_v2(reader->db, sql.c_str(), sql.length(), &reader->getStmt, nullptr);
+        checkSQLiteStatus(s);
+
+        Reader* result = reader.get();
+        {
+            std::lock_guard<std::mutex> lock(readersMutex);
+            readers.push_back(std::move(reader));
+        }
+        threadReaders[id] = result;
+        return *result;
+    }
+
+    void SQLite3PoolStore::_insert(const string& key, const string& value) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->insert(key, value);
+    }
+
+    void SQLite3PoolStore::_update(const string& key, const string& value) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->update(key, value);
+    }
+
+    string SQLite3PoolStore::_get(const string& key) {
+        Reader& r = reader();
+        int s = sqlite3_bind_blob(r.getStmt, 1, key.c_str(), key.length(), SQLITE_STATIC);
+        checkSQLiteStatus(s);
+        s = sqlite3_step(r.getStmt);
+        if (s == SQLITE_DONE) {
+            sqlite3_reset(r.getStmt);
+            throw std::runtime_error("Key not found");
+        }
+        checkSQLiteStatus(s);
+        string value(static_cast<const char*>(sqlite3_column_blob(r.getStmt, 0)), sqlite3_column_bytes(r.getStmt, 0));
+        // Resetting ends the read transaction, so the writer can checkpoint past it
+        s = sqlite3_reset(r.getStmt);
+        checkSQLiteStatus(s);
+        return value;
+    }
+
+    void SQLite3PoolStore::_remove(const string& key) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->remove(key);
+    }
+
+    void SQLite3PoolStore::_bulkRemove(const vector<string>& keys) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->bulkRemove(keys);
+    }
+
+    void SQLite3PoolStore::_removeRange(const vector<string>& keys) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->removeRange(keys);
+    }
+
+    void SQLite3PoolStore::_bulkInsert(const vector<pair<string, string>>& items) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->bulkInsert(items);
+    }
+
+    void SQLite3PoolStore::_append(const string& key, const string& suffix) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->append(key, suffix);
+    }
+
+    void SQLite3PoolStore::_readModifyWrite(const string& key, const ModifyFn& fn) {
+        std::lock_guard<std::mutex> lock(writerMutex);
+        writer->readModifyWrite(key, fn);
+    }
+
+    bool SQLite3PoolStore::threadSafe() { return true; }
+
+
+    MemoryStore::MemoryStore(const path& filepath) : Store(filepath) {
+        fs::remove_all(filepath);
+        fs::create_directories(filepath);
+    }
+
+    void MemoryStore::_insert(const string& key, const string& value) {
+        records.insert_or_assign(key, value);
+    }
+
+    void MemoryStore::_update(const string& key, const string& value) {
+        records.insert_or_assign(key, value);
+    }
+
+    string MemoryStore::_get(const string& key) {
+        auto it = records.find(key);
+        if (it == records.end())
+            throw std::runtime_error("Key not found");
+        return it->second;
+    }
+
+    void MemoryStore::_remove(const string& key) {
+        records.erase(key);
+    }
+
+    void MemoryStore::_readModifyWrite(const string& key, const ModifyFn& fn) {
+        auto it = records.find(key);
+        if (it == records.end())
+            throw std::runtime_error("Key not found");
+        it->second = fn(it->second);
+    }
+
+    void MemoryStore::_append(const string& key, const string& suffix) {
+        auto it = records.find(key);
+        if (it == records.end())
+            throw std::runtime_error("Key not found");
+        it->second += suffix;
+    }
+
+    bool MemoryStore::threadSafe() { return false; }
 }
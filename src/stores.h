@@ -8,20 +8,37 @@
 #include <filesystem>
 #include <vector>
 #include <utility>
+#include <functional>
+#include <atomic>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
 
 #include <sqlite3.h>
 #include "rocksdb/db.h"
 #include "leveldb/db.h"
+#include "leveldb/cache.h"
 #include <berkeleydb/include/db_cxx.h>
 
 namespace stores {
+    /** Computes a new value from the old value for `Store::readModifyWrite` */
+    using ModifyFn = std::function<std::string(const std::string&)>;
+
+    /**
+     * The file name the folder and file stores use for key: the key itself if it's only letters and digits, or else
+     * its hex encoding, so binary keys work too. The keys in a store should all be one format, or the encoding of one
+     * could be the same as another key.
+     */
+    std::string fileName(const std::string& key);
+
     /**
      * Abstract base class for a key-value store.
      * Can insert, update, get, and remove string keys and values.
      * Keeps count of how many records are in the store.
      */
     class Store {
-        size_t _count = 0;
+        std::atomic<size_t> _count = 0;
     protected:
         // subclasses will override these.
         virtual void _insert(const std::string& key, const std::string& value) = 0;
@@ -30,6 +47,12 @@ namespace stores {
         virtual void _remove(const std::string& key) = 0;
 
         virtual void _bulkInsert(const std::vector<std::pair<std::string, std::string>>& items);
+
+        virtual void _readModifyWrite(const std::string& key, const ModifyFn& fn);
+        virtual void _append(const std::string& key, const std::string& suffix);
+
+        virtual void _bulkRemove(const std::vector<std::string>& keys);
+        virtual void _removeRange(const std::vector<std::string>& keys);
     public:
         const std::filesystem::path filepath;
 
@@ -46,6 +69,39 @@ namespace stores {
 
         /** A potentially more efficient bulk insert. All items should be unique. */
         void bulkInsert(const std::vector<std::pair<std::string, std::string>>& items);
+
+        /**
+         * Replaces the value of an existing key with `fn(value)`. By default this is a get and an update. Stores
+         * override it when they can do it in a single lookup.
+         */
+        void readModifyWrite(const std::string& key, const ModifyFn& fn);
+
+        /**
+         * Appends suffix to the value of an existing key. This is a read-modify-write that some stores can do without
+         * reading the old value, e.g. with a merge operator or O_APPEND. By default it uses `readModifyWrite`.
+         */
+        void append(const std::string& key, const std::string& suffix);
+
+        /** A potentially more efficient bulk remove, e.g. when expiring records. All keys should exist. */
+        void bulkRemove(const std::vector<std::string>& keys);
+
+        /**
+         * Removes keys, which must be sorted and be every key in the store from `keys.front()` to `keys.back()`.
+         * Stores that support range deletes remove the range without looking at each key. Others use `bulkRemove`.
+         */
+        void removeRange(const std::vector<std::string>& keys);
+
+        /**
+         * Counters about what the engine did internally since the last `resetEngineStats`, such as
+         * "block cache hit rate" or "compaction bytes". Stores that don't expose their internals return an empty map.
+         */
+        virtual std::map<std::string, double> engineStats();
+
+        /** Starts a new interval for `engineStats` */
+        virtual void resetEngineStats();
+
+        /** Whether multiple threads can use the store at once (on different keys) without external locking */
+        virtual bool threadSafe();
     };
 
     /**
@@ -59,11 +115,19 @@ namespace stores {
         sqlite3_stmt* updateStmt = nullptr;
         sqlite3_stmt* getStmt = nullptr;
         sqlite3_stmt* removeStmt = nullptr;
+        sqlite3_stmt* appendStmt = nullptr;
 
         void checkStatus(int status);
+
+        /** Runs fn in a transaction, rolling it back if fn throws */
+        void transaction(const std::function<void()>& fn);
     public:
-        /** Create the store. Optionally pass flags from https://www.sqlite.org/c3ref/open.html */
-        SQLite3Store(const std::filesystem::path& filepath, int flags = 0);
+        /**
+         * Create the store. Optionally pass flags from https://www.sqlite.org/c3ref/open.html, the size of the
+         * page cache in bytes (0 for SQLite's default), and whether to use a write-ahead log instead of a rollback
+         * journal.
+         */
+        SQLite3Store(const std::filesystem::path& filepath, int flags = 0, size_t cacheSize = 0, bool wal = false);
 
         ~SQLite3Store();
 
@@ -75,7 +139,73 @@ namespace stores {
 
         void _remove(const std::string& key) override;
 
+        /** `DELETE ... WHERE key IN (...)` in batches, in a transaction */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        /** `DELETE ... WHERE key BETWEEN ? AND ?` */
+        void _removeRange(const std::vector<std::string>& keys) override;
+
         virtual void _bulkInsert(const std::vector<std::pair<std::string, std::string>>& items) override;
+
+        /** A single `UPDATE ... SET value = value || ?` */
+        void _append(const std::string& key, const std::string& suffix) override;
+    };
+
+    /**
+     * SQLite with a connection per thread, so that it can be read by multiple threads at once like the engines that
+     * share a handle. The database uses a write-ahead log so readers don't block each other or the writer. Each thread
+     * gets its own read only connection and prepared statement on its first get. Writes go through a single writer
+     * connection, one at a time.
+     */
+    class SQLite3PoolStore : public Store {
+        /** A connection used by a single thread */
+        struct Reader {
+            sqlite3* db = nullptr;
+            sqlite3_stmt* getStmt = nullptr;
+            ~Reader();
+        };
+
+        std::unique_ptr<SQLite3Store> writer;
+        std::mutex writerMutex;
+        size_t cacheSize;
+        /** Identifies the store in each thread's cache of readers, unlike its address which can be reused */
+        const uint64_t id;
+        std::mutex readersMutex;
+        std::vector<std::unique_ptr<Reader>> readers;
+
+        /** The calling thread's reader, opening it if needed */
+        Reader& reader();
+
+    public:
+        /** Create the store. cacheSize is the size of the page cache of each connection, 0 for SQLite's default. */
+        SQLite3PoolStore(const std::filesystem::path& filepath, size_t cacheSize = 0);
+
+        ~SQLite3PoolStore();
+
+        void _insert(const std::string& key, const std::string& value) override;
+
+        void _update(const std::string& key, const std::string& value) override;
+
+        std::string _get(const std::string& key) override;
+
+        void _remove(const std::string& key) override;
+
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        void _removeRange(const std::vector<std::string>& keys) override;
+
+        void _bulkInsert(const std::vector<std::pair<std::string, std::string>>& items) override;
+
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        /**
+         * Reads and writes on the writer connection while holding its lock, so concurrent read-modify-writes of a key
+         * don't lose updates
+         */
+        void _readModifyWrite(const std::string& key, const ModifyFn& fn) override;
+
+        /** Readers are per thread and the writer is locked */
+        bool threadSafe() override;
     };
 
 
@@ -85,12 +215,22 @@ namespace stores {
      */
     class LevelDBStore : public Store {
         leveldb::DB* db;
+        /** The block cache, if we made one. Must outlive db */
+        std::unique_ptr<leveldb::Cache> blockCache;
+        /** Cumulative compaction bytes from "leveldb.stats" at the last `resetEngineStats` */
+        double baseCompactionBytes = 0;
 
         void checkStatus(leveldb::Status status);
 
+        /** Parses the total compaction read and write bytes out of the "leveldb.stats" property */
+        double compactionBytes();
+
     public:
-        /** Create the store. Optionally pass leveldb Options. */
-        LevelDBStore(const std::filesystem::path& filepath, leveldb::Options options = {});
+        /**
+         * Create the store. Optionally pass leveldb Options, and the size of an LRU block cache for the store to
+         * create and own in bytes (0 to use options.block_cache).
+         */
+        LevelDBStore(const std::filesystem::path& filepath, leveldb::Options options = {}, size_t blockCacheSize = 0);
 
         ~LevelDBStore();
 
@@ -102,7 +242,16 @@ namespace stores {
 
         void _remove(const std::string& key) override;
 
+        /** A WriteBatch of deletes. LevelDB doesn't have range deletes so this is also used for `removeRange` */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
         virtual void _bulkInsert(const std::vector<std::pair<std::string, std::string>>& items) override;
+
+        std::map<std::string, double> engineStats() override;
+
+        void resetEngineStats() override;
+
+        bool threadSafe() override;
     };
 
 
@@ -112,11 +261,16 @@ namespace stores {
      */
     class RocksDBStore : public Store {
         rocksdb::DB* db;
+        std::shared_ptr<rocksdb::Statistics> statistics;
 
         void checkStatus(rocksdb::Status status);
 
     public:
-        /** Create the store. Optionally pass rocksdb Options. */
+        /**
+         * Create the store. Optionally pass rocksdb Options. Enables `rocksdb::Statistics` if options doesn't
+         * already have it, and counting in the `PerfContext` and `IOStatsContext` of the current thread. Sets an
+         * appending merge operator if options doesn't have one.
+         */
         RocksDBStore(const std::filesystem::path& filepath, rocksdb::Options options = {});
 
         ~RocksDBStore();
@@ -129,10 +283,40 @@ namespace stores {
 
         void _remove(const std::string& key) override;
 
+        /** A WriteBatch of deletes */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        /** A single DeleteRange tombstone */
+        void _removeRange(const std::vector<std::string>& keys) override;
+
         virtual void _bulkInsert(const std::vector<std::pair<std::string, std::string>>& items) override;
+
+        /**
+         * A Merge with an operator that appends. Stores use it unless options has another merge_operator. Unlike the
+         * other stores, appending to a missing key creates it rather than throwing, so appends stay blind writes.
+         */
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        std::map<std::string, double> engineStats() override;
+
+        void resetEngineStats() override;
+
+        bool threadSafe() override;
     };
 
 
+    /** Options for running BerkeleyDBStore in a `DbEnv` */
+    struct BerkeleyDBEnvOptions {
+        /** Size of the environment's memory pool (the cache) in bytes. 0 for BerkeleyDB's default */
+        size_t cacheSize = 0;
+        /** Database page size in bytes, a power of two from 512 to 64 KiB. 0 for BerkeleyDB's default */
+        u_int32_t pageSize = 0;
+        /** Enable locking, logging and transactions. Each op is committed in its own transaction. */
+        bool transactional = false;
+        /** Open the environment and database with DB_THREAD and locking so the store can be used from many threads */
+        bool threaded = false;
+    };
+
     /**
      * Wrapper around Berkeley DB.
      * See:
@@ -141,7 +325,12 @@ namespace stores {
      * - https://docs.oracle.com/database/bdb181/html/api_reference/CXX/frame_main.html
      */
     class BerkeleyDBStore : public Store {
+        /** Null if the Db is opened on its own */
+        std::unique_ptr<DbEnv> env;
         Db db;
+        DBTYPE dbtype;
+        bool threaded = false;
+        bool transactional = false;
 
         static Dbt makeDbt(const std::string& str);
 
@@ -149,10 +338,19 @@ namespace stores {
 
     public:
         /**
-         * Creates the store. Optionally pass DBTYPE and flags. See
-         * https://docs.oracle.com/database/bdb181/html/api_reference/CXX/frame_main.html `Db::open()`
+         * Creates the store as a bare database file. Optionally pass DBTYPE and flags (see
+         * https://docs.oracle.com/database/bdb181/html/api_reference/CXX/frame_main.html `Db::open()`), and the
+         * cache size in bytes (0 for BerkeleyDB's default).
+         */
+        BerkeleyDBStore(const std::filesystem::path& filepath, DBTYPE dbtype = DB_BTREE, u_int32_t flags = 0,
+                        size_t cacheSize = 0);
+
+        /**
+         * Creates the store in a `DbEnv` with its home at filepath, which lets it configure the cache, transactions,
+         * and threading. DBTYPE should be DB_BTREE or DB_HASH.
          */
-        BerkeleyDBStore(const std::filesystem::path& filepath, DBTYPE dbtype = DB_BTREE, u_int32_t flags = 0);
+        BerkeleyDBStore(const std::filesystem::path& filepath, const BerkeleyDBEnvOptions& envOptions,
+                        DBTYPE dbtype = DB_BTREE);
 
         ~BerkeleyDBStore();
 
@@ -163,11 +361,22 @@ namespace stores {
         std::string _get(const std::string& key) override;
 
         void _remove(const std::string& key) override;
+
+        /**
+         * Deletes with a cursor walking the range, without reading the values. Only B-trees are sorted, so hashes
+         * use `bulkRemove`.
+         */
+        void _removeRange(const std::vector<std::string>& keys) override;
+
+        /** Reads the record with a cursor, write locking it if there's locking, and replaces it through the cursor */
+        void _readModifyWrite(const std::string& key, const ModifyFn& fn) override;
+
+        bool threadSafe() override;
     };
 
 
     /**
-     * Stores each record as a file in a single folder with its key as the file name.
+     * Stores each record as a file in a single folder with its key as the file name, see `fileName`.
      */
     class FlatFolderStore : public Store {
         std::filesystem::path getPath(const std::string& key);
@@ -182,6 +391,14 @@ namespace stores {
         std::string _get(const std::string& key) override;
 
         void _remove(const std::string& key) override;
+
+        /** Unlinks the files in parallel */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        /** Opens the file with O_APPEND */
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        bool threadSafe() override;
     };
 
 
@@ -197,14 +414,19 @@ namespace stores {
      *   - cb
      *     - c87e4b5ce2fe28308fd9f2a7baf3
      * 
-     * Note: This does not hash the keys for you, and keys should be fixed width.
+     * Note: This does not hash the keys for you. Binary keys are hex encoded (see `fileName`), and shorter keys are
+     * padded to keyLen with '_', so sequential keys will share directories.
      */
     class NestedFolderStore : public Store {
+    protected:
         uint charsPerLevel;
         uint depth;
         size_t keyLen;
 
-        std::filesystem::path getPath(const std::string& key);
+        /** The file name for key, padded to keyLen. The directories are named by its prefixes. */
+        std::string keyName(const std::string& key);
+
+        virtual std::filesystem::path getPath(const std::string& key);
 
     public:
         /**
@@ -215,6 +437,262 @@ namespace stores {
          */
         NestedFolderStore(const std::filesystem::path& filepath, uint charsPerLevel, uint depth, size_t keyLen);
 
+        /**
+         * Picks `{charsPerLevel, depth}` for `count` hex keys of length keyLen so that the leaf directories have at
+         * most about filesPerDir files each on average, and no directory has more than about filesPerDir
+         * subdirectories. The prefix used, `charsPerLevel * (depth - 1)`, is always the prefix length picked for
+         * count, so e.g. 3 chars become 3 levels of 1 rather than 2 levels of 2. Small counts get a depth of 1, i.e.
+         * a flat folder.
+         */
+        static std::pair<uint, uint> autoLayout(size_t count, size_t filesPerDir, size_t keyLen);
+
+        void _insert(const std::string& key, const std::string& value) override;
+
+        void _update(const std::string& key, const std::string& value) override;
+
+        std::string _get(const std::string& key) override;
+
+        void _remove(const std::string& key) override;
+
+        /** Unlinks the files in parallel, and then removes directories that are now empty */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        /** Opens the file with O_APPEND */
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        bool threadSafe() override;
+    };
+
+
+    /**
+     * A NestedFolderStore that avoids re-resolving the full path on every op. It keeps a bounded LRU cache of open
+     * file descriptors for the directories at each nesting level, and uses `openat`, `mkdirat`, and `unlinkat`
+     * relative to them. Unlike NestedFolderStore, it also removes directories that become empty.
+     */
+    class NestedFolderFdStore : public NestedFolderStore {
+        int rootFd;
+        size_t maxOpenDirs;
+        /** Most recently used first. Directories are identified by their prefix of the key, e.g. "c4ca" */
+        std::list<std::pair<std::string, int>> openDirs;
+        std::unordered_map<std::string, std::list<std::pair<std::string, int>>::iterator> openDirsIndex;
+
+        /**
+         * Returns an fd for the directory at the given level of nesting for name (see `keyName`, 0 is the root).
+         * Creates the directories if create is true, otherwise returns -1 if the directory doesn't exist.
+         */
+        int getDir(const std::string& name, uint level, bool create);
+
+        /** Closes the directory and removes it from the cache if it's open */
+        void forgetDir(const std::string& prefix);
+
+        /** Copies the part of name (see `keyName`) used at the given level into a null-terminated buffer */
+        void getName(const std::string& name, uint level, char* buffer);
+
+    public:
+        /**
+         * Create the store. See NestedFolderStore.
+         * @param maxOpenDirs The max number of directory file descriptors to keep open (at least depth).
+         */
+        NestedFolderFdStore(const std::filesystem::path& filepath, uint charsPerLevel, uint depth, size_t keyLen,
+                            size_t maxOpenDirs = 1024);
+
+        ~NestedFolderFdStore();
+
+        void _insert(const std::string& key, const std::string& value) override;
+
+        void _update(const std::string& key, const std::string& value) override;
+
+        std::string _get(const std::string& key) override;
+
+        void _remove(const std::string& key) override;
+
+        /** One at a time, since the directory cache isn't thread safe */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        bool threadSafe() override;
+    };
+
+    /**
+     * A NestedFolderStore that doesn't need to know the record count up front. It starts out flat, and when a
+     * directory gets more than maxFilesPerDir files it splits it into subdirectories by the next charsPerLevel
+     * characters of the keys, moving its files down, like a trie. Directories are never merged back when records
+     * are removed. Which directories have been split is kept in memory. Reports "directory splits" and "files moved"
+     * as engine stats.
+     */
+    class ReshardingFolderStore : public NestedFolderStore {
+        size_t maxFilesPerDir;
+        /** Prefixes of the keys (e.g. "c4ca") of directories that have been split */
+        std::unordered_set<std::string> splitDirs;
+        /** Number of files in each leaf directory, by prefix */
+        std::unordered_map<std::string, size_t> fileCounts;
+        size_t splits = 0;
+        size_t filesMoved = 0;
+
+        /** The prefix of name (see `keyName`) identifying its leaf directory */
+        std::string leafPrefix(const std::string& name);
+
+        /** The path of the directory for a prefix */
+        std::filesystem::path prefixPath(const std::string& prefix);
+
+        /** Moves the files in the leaf directory for prefix into subdirectories, splitting them too if needed */
+        void split(const std::string& prefix);
+
+    protected:
+        std::filesystem::path getPath(const std::string& key) override;
+
+    public:
+        /**
+         * Create the store.
+         * @param charsPerLevel The number of characters of the key used for each level of nesting when splitting
+         * @param maxFilesPerDir Split a directory once it has more than this many files
+         * @param keyLen The size of each key
+         */
+        ReshardingFolderStore(const std::filesystem::path& filepath, uint charsPerLevel, size_t maxFilesPerDir,
+                              size_t keyLen);
+
+        void _insert(const std::string& key, const std::string& value) override;
+
+        void _update(const std::string& key, const std::string& value) override;
+
+        void _remove(const std::string& key) override;
+
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        std::map<std::string, double> engineStats() override;
+
+        void resetEngineStats() override;
+
+        /** The split bookkeeping isn't locked */
+        bool threadSafe() override;
+    };
+
+    /**
+     * Stores each record as a file in a single folder like FlatFolderStore, but uses raw `open`, `pwrite`, and
+     * `pread` on file descriptors instead of streams. Optionally:
+     * - preallocates each file's space with `fallocate` before writing it
+     * - replaces files atomically, so a reader (or a crash mid-write) never sees a partially written record. New
+     *   records are written to an anonymous `O_TMPFILE` and linked into place once complete, and updates are written
+     *   to a temporary file and renamed over the old one. Falls back to the temporary file for inserts if the file
+     *   system doesn't support `O_TMPFILE`. This doesn't fsync, like the other stores, so it isn't durable against
+     *   power loss.
+     * - uses `O_DIRECT` to bypass the page cache for large records
+     */
+    class PosixFileStore : public Store {
+        int dirFd;
+        bool preallocate;
+        bool atomicReplace;
+        size_t directMinSize;
+        std::atomic<bool> tmpFileSupported = true;
+        std::atomic<size_t> tmpFileCounter = 0;
+
+        /**
+         * Opens name (relative to the store folder) for writing a record of the given size, with O_DIRECT if the
+         * record is big enough and the file system supports it. Sets direct to whether O_DIRECT was used.
+         */
+        int openForWrite(const char* name, int flags, size_t size, bool& direct);
+
+        /** Writes value to a newly opened, empty file */
+        void writeFile(int fd, const std::string& value, bool direct);
+
+        /** Overwrites the record in place */
+        void writeInPlace(const std::string& key, const std::string& value);
+
+        /** Writes the record to a temporary file and renames it over the old record */
+        void replace(const std::string& key, const std::string& value);
+
+    public:
+        /**
+         * Create the store.
+         * @param preallocate Whether to `fallocate` files before writing them.
+         * @param atomicReplace Whether to write records to a temporary file and link or rename it into place.
+         * @param directMinSize Read and write records at least this big with `O_DIRECT`. 0 to never use it.
+         */
+        PosixFileStore(const std::filesystem::path& filepath, bool preallocate = true, bool atomicReplace = true,
+                       size_t directMinSize = 0);
+
+        ~PosixFileStore();
+
+        void _insert(const std::string& key, const std::string& value) override;
+
+        void _update(const std::string& key, const std::string& value) override;
+
+        std::string _get(const std::string& key) override;
+
+        void _remove(const std::string& key) override;
+
+        /** Unlinks the files in parallel */
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        /** Appends in place with O_APPEND, even with atomicReplace */
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        bool threadSafe() override;
+    };
+
+    /**
+     * Keeps small records inline in an embedded database, and spills records at least `threshold` bytes to files
+     * nested like NestedFolderStore. The database holds a marker for spilled records pointing at the file, whose path
+     * is derived from the key. Updates and removes read the marker first to find where the old value lives.
+     *
+     * Layout:
+     * - db: the database, created by makeDb
+     * - files: the spilled records
+     */
+    class HybridStore : public Store {
+        std::unique_ptr<Store> db;
+        std::unique_ptr<NestedFolderStore> files;
+        size_t threshold;
+
+        /** Whether the value stored in the database for a key says the record is in a file */
+        static bool inFile(const std::string& dbValue);
+
+    public:
+        /**
+         * Create the store.
+         * @param makeDb Creates the database to store small records in at the given path.
+         * @param threshold Records at least this big are stored as files.
+         * @param charsPerLevel, depth, keyLen See NestedFolderStore.
+         */
+        HybridStore(const std::filesystem::path& filepath,
+                    std::function<std::unique_ptr<Store>(const std::filesystem::path&)> makeDb, size_t threshold,
+                    uint charsPerLevel = 2, uint depth = 3, size_t keyLen = 32);
+
+        void _insert(const std::string& key, const std::string& value) override;
+
+        void _update(const std::string& key, const std::string& value) override;
+
+        std::string _get(const std::string& key) override;
+
+        void _remove(const std::string& key) override;
+
+        void _bulkRemove(const std::vector<std::string>& keys) override;
+
+        void _removeRange(const std::vector<std::string>& keys) override;
+
+        void _bulkInsert(const std::vector<std::pair<std::string, std::string>>& items) override;
+
+        /** The database's stats */
+        std::map<std::string, double> engineStats() override;
+
+        void resetEngineStats() override;
+
+        bool threadSafe() override;
+    };
+
+
+    /**
+     * Keeps the records in a hash map in memory and persists nothing. It isn't a real store, but a baseline for how
+     * much of each op is the benchmark harness and the Store interface rather than the engine.
+     */
+    class MemoryStore : public Store {
+        std::unordered_map<std::string, std::string> records;
+
+    public:
+        /** Creates an empty directory at filepath, so disk usage can be measured like for the other stores */
+        MemoryStore(const std::filesystem::path& filepath);
+
         void _insert(const std::string& key, const std::string& value) override;
 
         void _update(const std::string& key, const std::string& value) override;
@@ -222,5 +700,12 @@ namespace stores {
         std::string _get(const std::string& key) override;
 
         void _remove(const std::string& key) override;
+
+        /** Modifies the value in place */
+        void _readModifyWrite(const std::string& key, const ModifyFn& fn) override;
+
+        void _append(const std::string& key, const std::string& suffix) override;
+
+        bool threadSafe() override;
     };
 }
@@ -6,12 +6,21 @@
 #include <map>
 #include <string>
 #include <functional>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
 
 #define DOCTEST_CONFIG_IMPLEMENT
 #include "doctest/doctest.h"
 
 #include "stores.h"
 #include "utils.h"
+#include "trace.h"
+#include "samples.h"
+#include "metrics.h"
 
 namespace tests {
     namespace fs = std::filesystem;
@@ -24,11 +33,29 @@ namespace tests {
 
     vector<function<unique_ptr<Store>()>> storeFactories{
         [](){ return make_unique<stores::SQLite3Store>(filepath); },
+        [](){ return make_unique<stores::SQLite3Store>(filepath, 0, 1024 * 1024); },
+        [](){ return make_unique<stores::SQLite3PoolStore>(filepath); },
         [](){ return make_unique<stores::LevelDBStore>(filepath); },
+        [](){ return make_unique<stores::LevelDBStore>(filepath, leveldb::Options(), 1024 * 1024); },
         [](){ return make_unique<stores::RocksDBStore>(filepath); },
         [](){ return make_unique<stores::BerkeleyDBStore>(filepath); },
+        [](){ return make_unique<stores::BerkeleyDBStore>(filepath, DB_BTREE, 0, 1024 * 1024); },
+        [](){ return make_unique<stores::BerkeleyDBStore>(filepath, stores::BerkeleyDBEnvOptions{}); },
+        [](){
+            stores::BerkeleyDBEnvOptions options{1024 * 1024, 4096, true, true};
+            return make_unique<stores::BerkeleyDBStore>(filepath, options, DB_HASH);
+        },
         [](){ return make_unique<stores::FlatFolderStore>(filepath); },
         [](){ return make_unique<stores::NestedFolderStore>(filepath, 2, 3, 32); },
+        [](){ return make_unique<stores::NestedFolderFdStore>(filepath, 2, 3, 32); },
+        [](){ return make_unique<stores::ReshardingFolderStore>(filepath, 1, 2, 32); },
+        [](){ return make_unique<stores::PosixFileStore>(filepath); },
+        [](){ return make_unique<stores::PosixFileStore>(filepath, false, false, 1); },
+        [](){
+            auto makeDb = [](const path& dbPath) { return make_unique<stores::SQLite3Store>(dbPath); };
+            return make_unique<stores::HybridStore>(filepath, makeDb, 6);
+        },
+        [](){ return make_unique<stores::MemoryStore>(filepath); },
     };
 
 
@@ -68,6 +95,26 @@ namespace tests {
                 REQUIRE(store->get(key) == "\0goodbye\0"s);
             }
         }
+
+        SUBCASE("Key formats") {
+            for (auto format : {"binary", "varint", "uuidv7"}) {
+                utils::KeyGenerator genKey(format, "sequential");
+                for (auto storeFactory : storeFactories) {
+                    auto store = storeFactory();
+                    vector<string> keys;
+                    for (size_t i = 0; i < 300; i++) { // varints of 1 and 2 bytes
+                        keys.push_back(genKey(i));
+                        store->insert(keys.back(), std::to_string(i));
+                    }
+                    for (size_t i = 0; i < keys.size(); i++)
+                        REQUIRE(store->get(keys[i]) == std::to_string(i));
+                    std::sort(keys.begin(), keys.end()); // binary keys are hashes
+                    store->removeRange(vector<string>(keys.begin() + 10, keys.begin() + 20));
+                    REQUIRE_THROWS(store->get(keys[15]));
+                    REQUIRE(store->get(keys[20]) != "");
+                }
+            }
+        }
     }
 
     TEST_CASE("Test deletes if exists") {
@@ -123,4 +170,454 @@ namespace tests {
             REQUIRE(store->count() == 3);
         }
     }
+
+    TEST_CASE("Test append and read-modify-write") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+
+        for (auto& storeFactory : storeFactories) {
+            auto store = storeFactory();
+            string key = utils::randHash(32);
+            store->insert(key, "hello\0"s);
+            store->append(key, "world");
+            REQUIRE(store->get(key) == "hello\0world"s);
+
+            store->readModifyWrite(key, [](const string& value) { return value + "!"; });
+            REQUIRE(store->get(key) == "hello\0world!"s);
+            REQUIRE(store->count() == 1);
+
+            if (!dynamic_cast<stores::RocksDBStore*>(store.get())) { // RocksDB's Merge creates missing keys
+                string missing = utils::randHash(32);
+                REQUIRE_THROWS(store->append(missing, "world"));
+                REQUIRE_THROWS(store->get(missing));
+                REQUIRE(store->count() == 1);
+            }
+        }
+
+        REQUIRE(utils::incrementCounter("") == "\1\0\0\0\0\0\0\0"s);
+        REQUIRE(utils::incrementCounter("\xFF\0\0\0\0\0\0\0abc"s) == "\0\1\0\0\0\0\0\0abc"s);
+    }
+
+    TEST_CASE("Test bulk and range remove") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+
+        for (auto& storeFactory : storeFactories) {
+            auto store = storeFactory();
+            vector<string> keys;
+            for (int i = 0; i < 10; i++)
+                keys.push_back(utils::randHash(32));
+            std::sort(keys.begin(), keys.end());
+            vector<pair<string, string>> data;
+            for (auto& key : keys)
+                data.push_back({key, "value"});
+            store->bulkInsert(data);
+
+            store->removeRange(vector<string>(keys.begin() + 2, keys.begin() + 5));
+            store->bulkRemove({keys[0], keys[7], keys[9]});
+            REQUIRE(store->count() == 4);
+            for (int i : {0, 2, 3, 4, 7, 9})
+                REQUIRE_THROWS(store->get(keys[i]));
+            for (int i : {1, 5, 6, 8})
+                REQUIRE(store->get(keys[i]) == "value");
+        }
+    }
+
+    TEST_CASE("Test SQLite rolls back failed bulk ops") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+
+        stores::SQLite3Store store(filepath);
+        string key = utils::randHash(32), other = utils::randHash(32);
+        REQUIRE_THROWS(store.bulkInsert({{key, "value"}, {key, "value"}})); // duplicate key
+        REQUIRE(store.count() == 0);
+
+        // the transaction isn't left open, so later ops still work
+        store.bulkInsert({{key, "value"}, {other, "value"}});
+        REQUIRE(store.count() == 2);
+        store.bulkRemove({key});
+        REQUIRE(store.count() == 1);
+    }
+
+    TEST_CASE("Test engine stats") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+
+        for (auto& storeFactory : storeFactories) {
+            auto store = storeFactory();
+            store->resetEngineStats();
+            for (int i = 0; i < 25; i++)
+                store->insert(utils::randHash(32), utils::randBlob(64));
+            for (auto& [name, value] : store->engineStats())
+                REQUIRE(value >= 0);
+        }
+
+        auto rocksdb = make_unique<stores::RocksDBStore>(filepath);
+        string key = utils::randHash(32);
+        rocksdb->insert(key, "value");
+        rocksdb->resetEngineStats();
+        rocksdb->get(key);
+        REQUIRE(rocksdb->engineStats().at("memtable hits") == 1);
+    }
+
+    TEST_CASE("Test hybrid store") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+
+        auto makeDb = [](const path& dbPath) { return make_unique<stores::SQLite3Store>(dbPath); };
+        stores::HybridStore store(filepath, makeDb, 10);
+        string key = utils::randHash(32);
+        path file = path(filepath) / "files" / key.substr(0, 2) / key.substr(2, 2) / key.substr(4);
+
+        store.insert(key, "small");
+        REQUIRE(!fs::exists(file));
+        store.update(key, "large value");
+        REQUIRE(fs::exists(file));
+        REQUIRE(store.get(key) == "large value");
+        store.update(key, "small");
+        REQUIRE(!fs::exists(file));
+        REQUIRE(store.get(key) == "small");
+
+        store.update(key, "large value");
+        store.remove(key);
+        REQUIRE(!fs::exists(file));
+        REQUIRE_THROWS(store.get(key));
+    }
+
+    TEST_CASE("Test SQLite pool concurrent reads") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+
+        stores::SQLite3PoolStore store(filepath);
+        vector<string> keys;
+        for (int i = 0; i < 100; i++) {
+            keys.push_back(utils::randHash(32));
+            store.insert(keys.back(), "value");
+        }
+
+        std::atomic<bool> stop = false;
+        std::atomic<int> mismatches = 0;
+        vector<std::thread> readers;
+        for (int t = 0; t < 4; t++) {
+            readers.emplace_back([&]() {
+                for (size_t i = 0; !stop; i++) {
+                    string value = store.get(keys[i % keys.size()]);
+                    if (value != "value" && value != "updated") mismatches++;
+                }
+            });
+        }
+        for (auto& key : keys)
+            store.update(key, "updated");
+        stop = true;
+        for (auto& reader : readers)
+            reader.join();
+
+        REQUIRE(mismatches == 0);
+        for (auto& key : keys)
+            REQUIRE(store.get(key) == "updated");
+
+        // concurrent read-modify-writes of a key don't lose updates
+        string counter = keys.front();
+        store.update(counter, "0");
+        auto increment = [](const string& value) { return std::to_string(std::stoi(value) + 1); };
+        vector<std::thread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&]() {
+                for (int i = 0; i < 100; i++)
+                    store.readModifyWrite(counter, increment);
+            });
+        }
+        for (auto& writer : writers)
+            writer.join();
+        REQUIRE(store.get(counter) == "400");
+    }
+
+    TEST_CASE("Test nested folder layouts") {
+        using Layout = std::pair<uint, uint>;
+        REQUIRE(stores::NestedFolderStore::autoLayout(100, 256, 32) == Layout(1, 1));
+        REQUIRE(stores::NestedFolderStore::autoLayout(100'000, 256, 32) == Layout(2, 2));
+        REQUIRE(stores::NestedFolderStore::autoLayout(1'000'000, 256, 32) == Layout(1, 4));
+        REQUIRE(stores::NestedFolderStore::autoLayout(10'000'000, 256, 32) == Layout(2, 3));
+        REQUIRE(stores::NestedFolderStore::autoLayout(1'000'000, 16, 32) == Layout(1, 5));
+
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+        stores::ReshardingFolderStore store(filepath, 1, 8, 32);
+        vector<string> keys;
+        for (int i = 0; i < 200; i++) {
+            keys.push_back(utils::randHash(32));
+            store.insert(keys.back(), "value");
+        }
+        REQUIRE(store.engineStats().at("directory splits") > 0);
+        for (auto& key : keys)
+            REQUIRE(store.get(key) == "value");
+        for (auto& entry : fs::recursive_directory_iterator(filepath)) {
+            if (entry.is_directory()) {
+                auto files = std::count_if(fs::directory_iterator(entry.path()), fs::directory_iterator(),
+                                           [](auto& child) { return child.is_regular_file(); });
+                REQUIRE(files <= 8);
+            }
+        }
+    }
+
+    TEST_CASE("Test percentile") {
+        vector<long long> values{5, 1, 4, 2, 3};
+        REQUIRE(utils::percentile(values, 0) == 1);
+        REQUIRE(utils::percentile(values, 50) == 3);
+        REQUIRE(utils::percentile(values, 99) == 5);
+        REQUIRE(utils::percentile(values, 100) == 5);
+    }
+
+    TEST_CASE("Test CPU lists") {
+        REQUIRE((utils::parseCpuList("0-3,8,10-11\n") == vector<int>{0, 1, 2, 3, 8, 10, 11}));
+        REQUIRE(utils::formatCpuList({11, 0, 1, 2, 3, 8, 10}) == "0-3,8,10-11");
+        REQUIRE(utils::parseCpuList("").empty());
+        REQUIRE(!utils::threadAffinity().empty());
+    }
+
+    TEST_CASE("Test confidence intervals") {
+        REQUIRE(std::abs(utils::zScore(0.95) - 1.96) < 0.01);
+
+        vector<long long> values;
+        for (int i = 1; i <= 1000; i++)
+            values.push_back(i);
+        auto mean = utils::meanConfidenceInterval(values, 0.95);
+        REQUIRE(mean.estimate == 500.5);
+        REQUIRE(mean.low < 500.5);
+        REQUIRE(mean.high > 500.5);
+        REQUIRE(mean.relativeError() < 0.05);
+
+        std::shuffle(values.begin(), values.end(), utils::randGen);
+        auto p99 = utils::percentileConfidenceInterval(values, 99, 0.95);
+        REQUIRE(p99.statistic == "p99");
+        REQUIRE(p99.estimate == 990);
+        REQUIRE(p99.low <= 990);
+        REQUIRE(p99.high >= 990);
+
+        vector<long long> one{7};
+        REQUIRE(utils::meanConfidenceInterval(one, 0.95).relativeError() == 0);
+    }
+
+    TEST_CASE("Test Mann-Whitney U") {
+        vector<long long> low{1, 2, 3, 4, 5}, high{6, 7, 8, 9, 10};
+        auto test = utils::mannWhitneyU(high, low);
+        REQUIRE(test.u == 25);
+        REQUIRE(std::abs(test.z - 2.507) < 0.001);
+        REQUIRE(std::abs(test.p - 0.0122) < 0.0001);
+        REQUIRE(utils::mannWhitneyU(low, high).z == -test.z);
+
+        vector<long long> tied{1, 2, 2, 3, 3, 3}, same{7, 7, 7};
+        REQUIRE(utils::mannWhitneyU(tied, tied).p == 1);
+        REQUIRE(utils::mannWhitneyU(same, same).p == 1);
+
+        vector<long long> before, after;
+        for (int i = 0; i < 1000; i++) {
+            before.push_back(utils::randInt<long long>(1000, 2000));
+            after.push_back(utils::randInt<long long>(1100, 2100));
+        }
+        REQUIRE(utils::mannWhitneyU(after, before).p < 0.001);
+        REQUIRE(utils::mannWhitneyU(after, before).z > 0);
+    }
+
+    TEST_CASE("Test size distributions") {
+        vector<unique_ptr<utils::SizeDistribution>> dists;
+        dists.push_back(make_unique<utils::UniformSize>());
+        dists.push_back(make_unique<utils::FixedSize>());
+        dists.push_back(make_unique<utils::LogNormalSize>(1.0));
+        dists.push_back(make_unique<utils::ParetoSize>(1.16));
+
+        for (auto& dist : dists) {
+            for (utils::Range<size_t> range : {utils::Range<size_t>{1, 1023}, utils::Range<size_t>{1024, 10239}}) {
+                for (int i = 0; i < 1000; i++) {
+                    size_t size = (*dist)(range);
+                    REQUIRE((range.min <= size && size <= range.max));
+                }
+            }
+        }
+    }
+
+    TEST_CASE("Test trace record and replay") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+        path tracePath = path("out") / "tests" / "ops.trace";
+
+        {
+            trace::TraceWriter writer(tracePath);
+            for (size_t i = 0; i < 100; i++)
+                writer.write(trace::Op::Insert, utils::genKey(i), i);
+            writer.write(trace::Op::Update, utils::genKey(0), 10);
+            writer.write(trace::Op::Get, utils::genKey(0));
+            writer.write(trace::Op::Remove, utils::genKey(1));
+        }
+
+        trace::TraceReader reader(tracePath);
+        trace::Record record;
+        size_t records = 0;
+        auto last = std::chrono::nanoseconds(0);
+        while (reader.next(record)) {
+            REQUIRE(record.timestamp >= last);
+            last = record.timestamp;
+            if (records < 100) {
+                REQUIRE(record.op == trace::Op::Insert);
+                REQUIRE(record.key == utils::genKey(records));
+                REQUIRE(record.valueSize == records);
+            }
+            records++;
+        }
+        REQUIRE(records == 103);
+
+        for (auto& storeFactory : storeFactories) {
+            auto store = storeFactory();
+            auto result = trace::replay(*store, tracePath, [](size_t size) { return utils::randBlob(size); }, {4});
+            REQUIRE(result.errors == 0);
+            REQUIRE(result.stats.at(trace::Op::Insert).count() == 100);
+            REQUIRE(store->count() == 99);
+            REQUIRE(store->get(utils::genKey(0)).size() == 10);
+        }
+
+        // A bad trace throws instead of leaving the workers running
+        auto dataGen = [](size_t size) { return utils::randBlob(size); };
+        fs::resize_file(tracePath, fs::file_size(tracePath) - 1);
+        auto store = storeFactories.at(0)();
+        REQUIRE_THROWS(trace::replay(*store, tracePath, dataGen, {4}));
+        REQUIRE_THROWS(trace::replay(*store, path("out") / "tests" / "missing.trace", dataGen, {4}));
+    }
+
+    TEST_CASE("Test samples record and read") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/");
+        path samplesPath = path("out") / "tests" / "run.samples";
+
+        {
+            samples::SampleWriter writer(samplesPath);
+            auto id = writer.combination({0, "hw", "RocksDB", {1, 1023}, {100, 500}, "compressible", "uniform", 0,
+                                          "varint", "sequential", "out/stores", "ext4", "rw,relatime"});
+            for (size_t i = 0; i < 100'000; i++) // enough to fill a few buffers
+                writer.sample(id, trace::Op::Get, i, 10, std::chrono::nanoseconds(i + 1), {i % 3});
+            writer.engineStats(id, trace::Op::Get, {{"memtable hits", 2.5}});
+            writer.value(id, "space", 87);
+        }
+
+        samples::SampleReader reader(samplesPath);
+        samples::Record record;
+        REQUIRE(reader.next(record));
+        REQUIRE(record.type == samples::Record::Type::Combination);
+        REQUIRE(record.combination.store == "RocksDB");
+        REQUIRE(record.combination.count.max == 500);
+        REQUIRE(record.combination.mountOptions == "rw,relatime");
+
+        size_t count = 0;
+        auto last = std::chrono::nanoseconds(0);
+        while (reader.next(record) && record.type == samples::Record::Type::Sample) {
+            REQUIRE(record.sample.timestamp >= last);
+            last = record.sample.timestamp;
+            REQUIRE(record.sample.keyIndex == count);
+            REQUIRE(record.sample.latency.count() == (long long) count + 1);
+            REQUIRE(record.sample.counters == vector<uint64_t>{count % 3});
+            count++;
+        }
+        REQUIRE(count == 100'000);
+        REQUIRE(record.type == samples::Record::Type::EngineStats);
+        REQUIRE(record.engineStats.stats.at("memtable hits") == 2.5);
+        REQUIRE(reader.next(record));
+        REQUIRE(record.value.name == "space");
+        REQUIRE(record.value.value == 87);
+        REQUIRE(!reader.next(record));
+    }
+
+    TEST_CASE("Test metrics file") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/store");
+        path metricsPath = path("out") / "tests" / "benchmark.prom";
+
+        {
+            metrics::MetricsExporter exporter(metricsPath, std::chrono::seconds(60), true);
+            exporter.combination({{"store", "Rocks\"DB"}, {"records", "100"}}, filepath);
+            for (int i = 1; i <= 100; i++)
+                exporter.record(trace::Op::Get, std::chrono::nanoseconds(i));
+            exporter.record(trace::Op::Insert, std::chrono::nanoseconds(5));
+        } // writes the final metrics
+
+        std::ifstream file(metricsPath);
+        std::stringstream contents;
+        contents << file.rdbuf();
+        string text = contents.str();
+        REQUIRE(!fs::exists(path(metricsPath) += ".tmp"));
+        REQUIRE(text.find("kv_benchmark_combination_info{records=\"100\",store=\"Rocks\\\"DB\"} 1\n") != string::npos);
+        REQUIRE(text.find("kv_benchmark_ops_total{op=\"get\"} 100\n") != string::npos);
+        REQUIRE(text.find("kv_benchmark_ops_total{op=\"insert\"} 1\n") != string::npos);
+        REQUIRE(text.find("kv_benchmark_latency_nanoseconds{op=\"get\",quantile=\"0.5\"} 50\n") != string::npos);
+        REQUIRE(text.find("kv_benchmark_latency_nanoseconds{op=\"get\",quantile=\"1\"} 100\n") != string::npos);
+        REQUIRE(text.find("kv_benchmark_resident_memory_bytes ") != string::npos);
+        REQUIRE(text.find("kv_benchmark_disk_usage_bytes ") != string::npos);
+
+        metrics::LatencyHistogram histogram;
+        for (long long i = 1; i <= 1000; i++)
+            histogram.record(i * 1'000'000);
+        REQUIRE(histogram.count() == 1000);
+        REQUIRE(std::abs(histogram.percentile(50) - 500'000'000) <= 5'000'000);
+        REQUIRE(std::abs(histogram.percentile(99) - 990'000'000) <= 9'900'000);
+        REQUIRE(histogram.percentile(100) == 1'000'000'000);
+    }
+
+    TEST_CASE("Test key formats") {
+        REQUIRE(utils::KeyGenerator()(7) == utils::genKey(7));
+        REQUIRE(stores::fileName(utils::KeyGenerator("binary")(7)) == utils::genKey(7));
+        REQUIRE(utils::KeyGenerator("varint", "sequential")(0) == "\0"s);
+        REQUIRE(utils::KeyGenerator("varint", "sequential")(0x1234) == "\x02\x12\x34"s);
+        REQUIRE_THROWS(utils::KeyGenerator("base64"));
+
+        for (auto format : {"varint", "uuidv7"}) {
+            utils::KeyGenerator sequential(format, "sequential"), random(format, "random");
+            vector<string> sequentialKeys, randomKeys;
+            for (size_t i = 0; i < 10'000; i++) {
+                sequentialKeys.push_back(sequential(i));
+                randomKeys.push_back(random(i));
+            }
+            REQUIRE(std::is_sorted(sequentialKeys.begin(), sequentialKeys.end()));
+            REQUIRE(!std::is_sorted(randomKeys.begin(), randomKeys.end()));
+            std::sort(randomKeys.begin(), randomKeys.end());
+            REQUIRE(std::unique(randomKeys.begin(), randomKeys.end()) == randomKeys.end());
+        }
+        REQUIRE(utils::KeyGenerator("uuidv7", "sequential")(0).size() == 32);
+        REQUIRE(utils::KeyGenerator("uuidv7", "sequential")(0)[12] == '7');
+    }
+
+    TEST_CASE("Test file system info") {
+        fs::create_directories("out/tests/");
+        auto info = utils::fileSystemInfo("out/tests");
+        REQUIRE(!info.type.empty());
+        REQUIRE(!info.mountPoint.empty());
+        REQUIRE(info.available > 0);
+    }
+
+    TEST_CASE("Test seeded generators") {
+        uint64_t runSeed = utils::getSeed();
+
+        utils::seed(42);
+        string blob = utils::randBlob(1001), hash = utils::randHash(32);
+        utils::seed(42);
+        REQUIRE(utils::randBlob(1001) == blob);
+        REQUIRE(utils::randHash(32) == hash);
+        REQUIRE(utils::randBlob(1001) != blob);
+
+        utils::seed(runSeed); // Don't make the benchmark itself use a fixed seed
+    }
+
+    TEST_CASE("Test ClobGenerator") {
+        fs::remove_all("out/tests");
+        fs::create_directories("out/tests/text");
+        std::ofstream("out/tests/text/a.txt") << "aaaaaaaaaa";
+        std::ofstream("out/tests/text/empty.txt");
+        std::ofstream("out/tests/text/b.txt") << "bbbbbbbbbb";
+
+        utils::ClobGenerator randClob("out/tests/text");
+        for (int i = 0; i < 100; i++) {
+            string clob = randClob(15); // Always spans both files
+            REQUIRE(clob.size() == 15);
+            REQUIRE((clob.find("ab") != string::npos || clob.find("ba") != string::npos));
+        }
+        REQUIRE(randClob(20).size() == 20);
+        REQUIRE_THROWS(randClob(21));
+    }
 }
\ No newline at end of file
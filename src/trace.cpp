@@ -0,0 +1,236 @@
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+
+#include "trace.h"
+
+namespace trace {
+    namespace fs = std::filesystem;
+    using fs::path;
+    namespace chrono = std::chrono;
+    using std::string, std::vector, std::unique_ptr, std::make_unique;
+
+    const string MAGIC = "KVTRACE1";
+    /** Flush the write buffer to the file once it gets this big */
+    const size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+
+    string opName(Op op) {
+        switch (op) {
+            case Op::Insert: return "insert";
+            case Op::Update: return "update";
+            case Op::Get: return "get";
+            case Op::Remove: return "remove";
+            case Op::Append: return "append";
+            case Op::ReadModifyWrite: return "read-modify-write";
+        }
+        throw std::runtime_error("Unknown op " + std::to_string((int) op));
+    }
+
+    static void writeVarint(string& buffer, uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back((char) (value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back((char) value);
+    }
+
+
+    TraceWriter::TraceWriter(const path& filepath) :
+        file(filepath, std::ofstream::out|std::ofstream::binary|std::ofstream::trunc),
+        start(chrono::steady_clock::now()) {
+        if (!file.is_open())
+            throw std::runtime_error("Couldn't open trace " + filepath.native());
+        buffer += MAGIC;
+    }
+
+    TraceWriter::~TraceWriter() {
+        flush();
+    }
+
+    void TraceWriter::write(Op op, const string& key, size_t valueSize) {
+        auto timestamp = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+        write({op, key, valueSize, timestamp});
+    }
+
+    void TraceWriter::write(const Record& record) {
+        if (record.timestamp < last)
+            throw std::runtime_error("Trace timestamps must not decrease");
+
+        buffer.push_back((char) record.op);
+        writeVarint(buffer, (record.timestamp - last).count());
+        writeVarint(buffer, record.key.size());
+        buffer += record.key;
+        writeVarint(buffer, record.valueSize);
+        last = record.timestamp;
+
+        if (buffer.size() >= WRITE_BUFFER_SIZE)
+            flush();
+    }
+
+    void TraceWriter::flush() {
+        file.write(buffer.data(), buffer.size());
+        file.flush();
+        buffer.clear();
+    }
+
+
+    TraceReader::TraceReader(const path& filepath) : file(filepath, std::ifstream::in|std::ifstream::binary) {
+        if (!file.is_open())
+            throw std::runtime_error("Couldn't open trace " + filepath.native());
+        string magic(MAGIC.size(), '\0');
+        file.read(&magic[0], magic.size());
+        if (magic != MAGIC)
+            throw std::runtime_error(filepath.native() + " is not a trace file");
+    }
+
+    uint64_t TraceReader::readVarint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = file.get();
+            if (byte == EOF)
+                throw std::runtime_error("Trace ends in the middle of a record");
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Invalid varint in trace");
+    }
+
+    bool TraceReader::next(Record& record) {
+        int op = file.get();
+        if (op == EOF)
+            return false;
+        if (op > (int) Op::ReadModifyWrite)
+            throw std::runtime_error("Unknown op " + std::to_string(op) + " in trace");
+
+        record.op = (Op) op;
+        last += chrono::nanoseconds(readVarint());
+        record.timestamp = last;
+        record.key.resize(readVarint());
+        file.read(&record.key[0], record.key.size());
+        record.valueSize = readVarint();
+        if (!file)
+            throw std::runtime_error("Trace ends in the middle of a record");
+        return true;
+    }
+
+
+    /** A blocking, fixed capacity, multi-producer multi-consumer queue */
+    template<typename T>
+    class BoundedQueue {
+        std::queue<T> items;
+        size_t capacity;
+        bool closed = false;
+        std::mutex mutex;
+        std::condition_variable notFull, notEmpty;
+
+    public:
+        BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+        void push(T item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notFull.wait(lock, [&]() { return items.size() < capacity; });
+            items.push(std::move(item));
+            notEmpty.notify_one();
+        }
+
+        /** Waits for an item. Returns false if the queue has been closed and is empty. */
+        bool pop(T& item) {
+            std::unique_lock<std::mutex> lock(mutex);
+            notEmpty.wait(lock, [&]() { return !items.empty() || closed; });
+            if (items.empty())
+                return false;
+            item = std::move(items.front());
+            items.pop();
+            notFull.notify_one();
+            return true;
+        }
+
+        /** No more items will be pushed */
+        void close() {
+            std::unique_lock<std::mutex> lock(mutex);
+            closed = true;
+            notEmpty.notify_all();
+        }
+    };
+
+
+    ReplayResult replay(stores::Store& store, const path& tracePath, std::function<string(size_t)> dataGen,
+                        const ReplayOptions& options) {
+        TraceReader reader(tracePath); // open it before starting the workers, so a bad path just throws
+        unsigned threads = std::max(options.threads, 1u);
+        vector<unique_ptr<BoundedQueue<Record>>> queues;
+        for (unsigned t = 0; t < threads; t++)
+            queues.push_back(make_unique<BoundedQueue<Record>>(10'000));
+
+        std::mutex storeMutex;
+        vector<ReplayResult> results(threads);
+        auto start = chrono::steady_clock::now();
+
+        vector<std::thread> workers;
+        auto finish = [&]() {
+            for (auto& queue : queues)
+                queue->close();
+            for (auto& worker : workers)
+                worker.join();
+        };
+        try {
+            for (unsigned t = 0; t < threads; t++) {
+                workers.emplace_back([&, t]() {
+                    Record record;
+                    while (queues[t]->pop(record)) {
+                        string value;
+                        if (record.op == Op::Insert || record.op == Op::Update || record.op == Op::Append)
+                            value = dataGen(record.valueSize);
+                        if (options.originalTiming)
+                            std::this_thread::sleep_until(start + record.timestamp);
+
+                        std::unique_lock<std::mutex> lock(storeMutex, std::defer_lock);
+                        if (!store.threadSafe()) lock.lock();
+                        try {
+                            auto time = utils::timeIt([&]() {
+                                switch (record.op) {
+                                    case Op::Insert: store.insert(record.key, value); break;
+                                    case Op::Update: store.update(record.key, value); break;
+                                    case Op::Get: store.get(record.key); break;
+                                    case Op::Remove: store.remove(record.key); break;
+                                    case Op::Append: store.append(record.key, value); break;
+                                    case Op::ReadModifyWrite:
+                                        store.readModifyWrite(record.key, utils::incrementCounter);
+                                        break;
+                                }
+                            });
+                            results[t].stats[record.op].record(time.count());
+                        } catch (const std::exception&) {
+                            results[t].errors++;
+                        }
+                    }
+                });
+            }
+
+            // Partition by key so ops on the same key stay in order
+            Record record;
+            std::hash<string> hash;
+            while (reader.next(record))
+                queues[hash(record.key) % threads]->push(std::move(record));
+        } catch (...) { // e.g. a corrupt trace, the workers must be joined before the threads are destroyed
+            finish();
+            throw;
+        }
+        finish();
+
+        ReplayResult total;
+        total.elapsed = chrono::steady_clock::now() - start;
+        for (auto& result : results) {
+            for (auto& [op, stats] : result.stats)
+                total.stats[op].merge(stats);
+            total.errors += result.errors;
+        }
+        return total;
+    }
+}
@@ -0,0 +1,94 @@
+/**
+ * Recording and replaying sequences of store operations.
+ *
+ * Traces use a compact binary format so that long production traces stay small and can be streamed from disk. A
+ * trace file starts with the magic "KVTRACE1" followed by a record for each op:
+ * - op: 1 byte (see `trace::Op`)
+ * - timestamp: varint, nanoseconds since the previous record
+ * - key length: varint, followed by the key bytes
+ * - value size: varint (the size of the suffix for append, and 0 for get, remove, and read-modify-write)
+ * Varints are unsigned LEB128.
+ */
+#pragma once
+#include <string>
+#include <map>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+#include "stores.h"
+#include "utils.h"
+
+namespace trace {
+    /** ReadModifyWrite replays as a counter bump, see `utils::incrementCounter` */
+    enum class Op : uint8_t { Insert = 0, Update = 1, Get = 2, Remove = 3, Append = 4, ReadModifyWrite = 5 };
+
+    /** Returns "insert", "update", "get", "remove", "append", or "read-modify-write" */
+    std::string opName(Op op);
+
+    struct Record {
+        Op op;
+        std::string key;
+        size_t valueSize;
+        /** Time since the start of the trace */
+        std::chrono::nanoseconds timestamp;
+    };
+
+    /** Writes a trace file. Writes are buffered in memory. */
+    class TraceWriter {
+        std::ofstream file;
+        std::string buffer;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::nanoseconds last{0};
+
+    public:
+        TraceWriter(const std::filesystem::path& filepath);
+        ~TraceWriter();
+
+        /** Record an op that just happened, timestamped with the time since the writer was created */
+        void write(Op op, const std::string& key, size_t valueSize = 0);
+
+        /** Write a record with an explicit timestamp, e.g. when converting logs. Timestamps must not decrease. */
+        void write(const Record& record);
+
+        void flush();
+    };
+
+    /** Streams records from a trace file */
+    class TraceReader {
+        std::ifstream file;
+        std::chrono::nanoseconds last{0};
+
+        uint64_t readVarint();
+
+    public:
+        TraceReader(const std::filesystem::path& filepath);
+
+        /** Reads the next record. Returns false at the end of the trace. */
+        bool next(Record& record);
+    };
+
+    struct ReplayOptions {
+        /** Number of threads issuing ops. Ops on the same key always go to the same thread, so stay in order */
+        unsigned threads = 1;
+        /** Wait until each op's timestamp to issue it, rather than issuing ops as fast as possible */
+        bool originalTiming = false;
+    };
+
+    struct ReplayResult {
+        /** Latencies in nanoseconds for each op type */
+        std::map<Op, utils::Stats<long long>> stats;
+        /** Number of ops that failed, e.g. a get of a key the trace never inserted */
+        size_t errors = 0;
+        std::chrono::nanoseconds elapsed{0};
+    };
+
+    /**
+     * Replays a trace against store. Values are generated with dataGen, which is called from multiple threads. The
+     * trace is streamed so it can be larger than memory. Stores that aren't `threadSafe` are locked around each op.
+     */
+    ReplayResult replay(stores::Store& store, const std::filesystem::path& tracePath,
+                        std::function<std::string(size_t)> dataGen, const ReplayOptions& options);
+}
@@ -8,7 +8,17 @@
 #include <cmath>
 #include <algorithm>
 #include <fstream>
+#include <sstream>
+#include <atomic>
+#include <cstring>
 #include <sys/resource.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <boost/process.hpp>
 #include <boost/uuid/detail/sha1.hpp>
@@ -24,60 +34,189 @@ namespace utils {
     using boost::uuids::detail::sha1;
 
     std::random_device randomDevice;
-    std::mt19937 randGen(randomDevice());
+    static std::atomic<uint64_t> runSeed = ((uint64_t) randomDevice() << 32) | randomDevice();
+    static std::atomic<uint64_t> threadsSeeded = 0;
+
+    /** See https://prng.di.unimi.it/splitmix64.c, used to turn similar seeds into very different states */
+    static uint64_t splitmix64(uint64_t& x) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    /** Get a seed for a new generator, derived from the run seed */
+    static uint64_t nextSeed() {
+        uint64_t x = runSeed + threadsSeeded++;
+        return splitmix64(x);
+    }
+
+    void FastRand::fill(char* buffer, size_t size) {
+        // Work on a local copy of the state, otherwise the compiler has to assume writes to buffer could change it
+        FastRand gen = *this;
+        size_t i = 0;
+        for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+            uint64_t r = gen();
+            std::memcpy(buffer + i, &r, sizeof(r)); // compiles to a single unaligned store
+        }
+        if (i < size) {
+            uint64_t r = gen();
+            std::memcpy(buffer + i, &r, size - i);
+        }
+        *this = gen;
+    }
+
+    thread_local std::mt19937 randGen(nextSeed());
+    thread_local FastRand fastRand(nextSeed());
+
+    void seed(uint64_t seed) {
+        // Make sure this thread's generators are initialized first so that doesn't use up seeds
+        std::mt19937& gen = randGen;
+        FastRand& fast = fastRand;
+        runSeed = seed;
+        threadsSeeded = 0;
+        gen.seed(nextSeed());
+        fast = FastRand(nextSeed());
+    }
+
+    uint64_t getSeed() {
+        return runSeed;
+    }
+
+    size_t UniformSize::operator()(Range<size_t> range) {
+        return randInt(range.min, range.max);
+    }
+
+    FixedSize::FixedSize(size_t size) : size(size) {}
+
+    size_t FixedSize::operator()(Range<size_t> range) {
+        if (size == 0)
+            return range.min + (range.max - range.min) / 2;
+        return std::clamp(size, range.min, range.max);
+    }
+
+    LogNormalSize::LogNormalSize(double sigma) : sigma(sigma) {}
+
+    size_t LogNormalSize::operator()(Range<size_t> range) {
+        double median = std::sqrt((double) std::max<size_t>(range.min, 1) * range.max);
+        std::lognormal_distribution<double> dist(std::log(median), sigma);
+        // Resample values outside the range. The range always contains the median so this shouldn't take many tries
+        for (int i = 0; i < 100; i++) {
+            double size = std::round(dist(randGen));
+            if (range.min <= size && size <= range.max)
+                return size;
+        }
+        return median;
+    }
+
+    ParetoSize::ParetoSize(double alpha) : alpha(alpha) {}
+
+    size_t ParetoSize::operator()(Range<size_t> range) {
+        // Inverse CDF of the Pareto distribution truncated to [low, high].
+        // See https://en.wikipedia.org/wiki/Pareto_distribution#Bounded_Pareto_distribution
+        double low = std::max<size_t>(range.min, 1), high = range.max + 1;
+        if (low >= high) return range.min;
+        double u = std::uniform_real_distribution<double>(0, 1)(randGen);
+        double lowA = std::pow(low, alpha), highA = std::pow(high, alpha);
+        double size = std::pow(-(u * highA - u * lowA - highA) / (highA * lowA), -1 / alpha);
+        return std::clamp<size_t>(std::floor(size), range.min, range.max);
+    }
+
+    EmpiricalSize::EmpiricalSize(const path& histogramFile) {
+        ifstream file(histogramFile);
+        if (!file.is_open())
+            throw std::runtime_error("Couldn't open histogram " + histogramFile.native());
+        string line;
+        while (std::getline(file, line)) {
+            std::istringstream row(line);
+            Bucket bucket;
+            if (line.rfind("#", 0) != 0 && row >> bucket.size.min >> bucket.size.max >> bucket.weight)
+                buckets.push_back(bucket);
+        }
+        if (buckets.empty())
+            throw std::runtime_error("Histogram " + histogramFile.native() + " is empty");
+    }
+
+    size_t EmpiricalSize::operator()(Range<size_t> range) {
+        // Weight each bucket by how much of it overlaps with the range
+        vector<double> weights;
+        for (auto& bucket : buckets) {
+            double overlap = (double) std::min(bucket.size.max, range.max) - std::max(bucket.size.min, range.min) + 1;
+            double width = bucket.size.max - bucket.size.min + 1;
+            weights.push_back(std::max(overlap, 0.0) / width * bucket.weight);
+        }
+        if (std::all_of(weights.begin(), weights.end(), [](double w) { return w <= 0; }))
+            return randInt(range.min, range.max); // No data for this range
+
+        std::discrete_distribution<size_t> pickBucket(weights.begin(), weights.end());
+        auto& bucket = buckets[pickBucket(randGen)];
+        return randInt(std::max(bucket.size.min, range.min), std::min(bucket.size.max, range.max));
+    }
 
     string randBlob(size_t size) {
-        std::uniform_int_distribution<unsigned char> randChar(0, 0xFF);
-        string blob;
-        blob.resize(size);
-        std::generate(blob.begin(), blob.end(), [&]() { return randChar(randGen); });
+        string blob(size, '\0');
+        randBlob(&blob[0], size);
         return blob;
     }
 
+    void randBlob(char* buffer, size_t size) {
+        fastRand.fill(buffer, size);
+    }
+
     string randBlob(Range<size_t> size) {
         return randBlob(randInt(size.min, size.max));
     }
 
-    ClobGenerator::ClobGenerator(const path& textFolder) : textFolder(textFolder), filesTotalSize(0) {
-        // Cache the file list
-        for (auto file : fs::directory_iterator(this->textFolder)) {
-            if (file.path().extension() == ".txt") {
-                this->fileSizes.push_back({file.path(), file.file_size()});
-                filesTotalSize += file.file_size();
+    ClobGenerator::ClobGenerator(const path& textFolder) {
+        auto corpus = std::make_shared<Corpus>();
+        for (auto file : fs::directory_iterator(textFolder)) {
+            if (file.path().extension() == ".txt" && file.file_size() > 0) {
+                int fd = open(file.path().c_str(), O_RDONLY);
+                if (fd < 0)
+                    throw std::runtime_error("Couldn't open " + file.path().native());
+                void* data = mmap(nullptr, file.file_size(), PROT_READ, MAP_PRIVATE, fd, 0);
+                close(fd); // the mapping keeps the file open
+                if (data == MAP_FAILED)
+                    throw std::runtime_error("Couldn't mmap " + file.path().native());
+
+                corpus->files.push_back({static_cast<const char*>(data), file.file_size()});
+                corpus->offsets.push_back(corpus->totalSize);
+                corpus->totalSize += file.file_size();
             }
         }
+        this->corpus = corpus;
     }
 
-    string ClobGenerator::operator()(size_t size) {
-        // Pick an evenly distributed substr of all the files by conceptually concatenating them all then picking a
-        // random substr from that. We need the sizes of all files to do that without actually reading all in.
-        // This implementation will probably have issues with variable width encodings (UTF-8)...
-        size_t start = randInt<size_t>(0, this->filesTotalSize - size);
-        size_t end = start + size;
-
-        size_t pos = 0;
-        auto fileInfo = this->fileSizes.begin();
-        for (; pos + fileInfo->size < start; fileInfo++) {
-            pos += fileInfo->size;
-        }
+    ClobGenerator::Corpus::~Corpus() {
+        for (auto& file : files)
+            munmap((void*) file.data, file.size);
+    }
 
+    string ClobGenerator::operator()(size_t size) {
         string clob(size, '\0');
-        while (pos < end) {
-            ifstream file(fileInfo->file, ifstream::in|ifstream::binary);
-            if (pos < start) {
-                file.seekg(start - pos);
-                pos = start;
-            }
-
-            auto bufferPos = pos - start;
-            auto remainingFile = fileInfo->size - file.tellg();
-            file.read(&clob[bufferPos], std::min(remainingFile, size - bufferPos)); // read up to EOF or end of buffer
+        fill(&clob[0], size);
+        return clob;
+    }
 
-            pos += remainingFile;
-            fileInfo++;
+    void ClobGenerator::fill(char* buffer, size_t size) {
+        // Pick an evenly distributed substr of all the files by conceptually concatenating them all then picking a
+        // random substr from that.
+        // This implementation will probably have issues with variable width encodings (UTF-8)...
+        if (size > corpus->totalSize)
+            throw std::runtime_error("Clob of size " + std::to_string(size) + " is bigger than the text files");
+        size_t pos = randInt<size_t>(0, corpus->totalSize - size);
+
+        // Find the last file starting at or before pos
+        size_t i = std::upper_bound(corpus->offsets.begin(), corpus->offsets.end(), pos) - corpus->offsets.begin() - 1;
+        size_t copied = 0;
+        while (copied < size) { // Usually just one memcpy, unless the clob spans files
+            auto& file = corpus->files[i];
+            size_t fileOffset = pos + copied - corpus->offsets[i];
+            size_t len = std::min(file.size - fileOffset, size - copied);
+            std::memcpy(buffer + copied, file.data + fileOffset, len);
+            copied += len;
+            i++;
         }
-
-        return clob;
     }
 
     string ClobGenerator::operator()(Range<size_t> size){
@@ -99,17 +238,94 @@ namespace utils {
         return hash;
     }
 
-    string genKey(size_t i) {
+    /** The first 16 bytes of a salted SHA-1 of i */
+    static string hashKey(size_t i) {
         sha1 hash;
         hash.process_bytes(reinterpret_cast<void*>(&i), sizeof(i));
         hash.process_byte(136); // An arbitrary salt
         sha1::digest_type digest;
         hash.get_digest(digest);
 
-        std::stringstream ss;
+        string bytes;
         for (auto part : digest)
-            ss << std::setfill('0') << std::setw(sizeof(part) * 2) << std::hex << part;
-        return ss.str().substr(0, 32);
+            for (int shift = 24; shift >= 0; shift -= 8)
+                bytes.push_back((char) (part >> shift));
+        return bytes.substr(0, 16);
+    }
+
+    string toHex(const string& bytes) {
+        const char* digits = "0123456789abcdef";
+        string hex;
+        hex.reserve(bytes.size() * 2);
+        for (unsigned char c : bytes) {
+            hex.push_back(digits[c >> 4]);
+            hex.push_back(digits[c & 0xF]);
+        }
+        return hex;
+    }
+
+    string genKey(size_t i) {
+        return toHex(hashKey(i));
+    }
+
+    KeyGenerator::KeyGenerator(const string& format, const string& order) : format(format), order(order) {
+        const std::map<string, Format> formats{
+            {"hex", Format::Hex}, {"binary", Format::Binary}, {"varint", Format::Varint}, {"uuidv7", Format::UuidV7},
+        };
+        if (!formats.count(format))
+            throw std::runtime_error("Unknown key format " + format);
+        if (order != "sequential" && order != "random")
+            throw std::runtime_error("Unknown insertion order " + order);
+        formatId = formats.at(format);
+        shuffle = order == "random";
+    }
+
+    bool KeyGenerator::hasOrder(const string& format) {
+        return format != "hex" && format != "binary";
+    }
+
+    string KeyGenerator::operator()(size_t i) const {
+        uint64_t n = i;
+        if (shuffle && (formatId == Format::Varint || formatId == Format::UuidV7)) {
+            const uint64_t mask = (1ULL << 40) - 1;
+            if (n > mask)
+                throw std::runtime_error("Can't shuffle key index " + std::to_string(i));
+            // Multiplying by an odd number and xorshifts are both bijections mod 2^40
+            n = (n * 0x9E3779B97F4A7C15ULL) & mask;
+            n ^= n >> 20;
+            n = (n * 0xBF58476D1CE4E5B9ULL) & mask;
+            n ^= n >> 20;
+        }
+
+        switch (formatId) {
+            case Format::Hex:
+                return genKey(n);
+            case Format::Binary:
+                return hashKey(n);
+            case Format::Varint: {
+                string key(1, '\0');
+                for (int shift = 56; shift >= 0; shift -= 8) {
+                    if (key.size() > 1 || (n >> shift) != 0)
+                        key.push_back((char) (n >> shift));
+                }
+                key[0] = (char) (key.size() - 1);
+                return key;
+            }
+            case Format::UuidV7: {
+                const uint64_t start = 1'600'000'000'000; // 2020-09-13 in milliseconds since the epoch
+                uint64_t timestamp = start + n;
+                string hash = hashKey(n);
+                string uuid;
+                for (int shift = 40; shift >= 0; shift -= 8)
+                    uuid.push_back((char) (timestamp >> shift));
+                uuid.push_back((char) (0x70 | (hash[0] & 0x0F))); // version 7
+                uuid.push_back(hash[1]);
+                uuid.push_back((char) (0x80 | (hash[2] & 0x3F))); // RFC 4122 variant
+                uuid += hash.substr(3, 7);
+                return toHex(uuid);
+            }
+        }
+        throw std::runtime_error("Unknown key format " + format);
     }
 
 
@@ -143,6 +359,14 @@ namespace utils {
         return info.ru_maxrss; // ru_maxrss is the resident set size in kB
     }
 
+    size_t getMemUsage() {
+        // See https://man7.org/linux/man-pages/man5/proc.5.html, the second field is the resident pages
+        ifstream statm("/proc/self/statm");
+        size_t size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * sysconf(_SC_PAGESIZE) / 1024;
+    }
+
     void resetPeakMemUsage() {
         // See https://man7.org/linux/man-pages/man5/proc.5.html
         ofstream clearRefs("/proc/self/clear_refs");
@@ -150,6 +374,243 @@ namespace utils {
     }
 
 
+    /** Writes a value to a cgroup control file, throwing if the kernel rejects it */
+    static void writeControl(const path& file, const string& value) {
+        ofstream stream(file);
+        stream << value;
+        stream.flush();
+        if (!stream)
+            throw std::runtime_error("Couldn't write \"" + value + "\" to " + file.native());
+    }
+
+    MemoryCgroup::MemoryCgroup() {
+        // /proc/self/cgroup has a line like "0::/user.slice/session-1.scope" for cgroup v2
+        ifstream cgroupFile("/proc/self/cgroup");
+        string line, current;
+        while (std::getline(cgroupFile, line))
+            if (line.rfind("0::", 0) == 0)
+                current = line.substr(3);
+        // Usually mounted at /sys/fs/cgroup, or /sys/fs/cgroup/unified on hybrid v1/v2 systems
+        ifstream mounts("/proc/self/mounts");
+        string device, mountPoint, type, rest, root;
+        while (mounts >> device >> mountPoint >> type && std::getline(mounts, rest))
+            if (type == "cgroup2")
+                root = mountPoint;
+        if (current.empty() || root.empty())
+            throw std::runtime_error("cgroup v2 isn't mounted");
+
+        original = path(root) / path(current).relative_path();
+        group = original / ("kv-benchmark-" + std::to_string(getpid()));
+        cgroup = group / "benchmark";
+        std::error_code error;
+        fs::create_directories(cgroup, error);
+        if (error)
+            throw std::runtime_error("Couldn't create cgroup " + cgroup.native() + ": " + error.message());
+
+        try {
+            // Move into the leaf first, cgroups with processes can't enable controllers for their children
+            writeControl(cgroup / "cgroup.procs", std::to_string(getpid()));
+            if (!hasMemoryController(original / "cgroup.subtree_control")) {
+                writeControl(original / "cgroup.subtree_control", "+memory");
+                enabledInOriginal = true;
+            }
+            writeControl(group / "cgroup.subtree_control", "+memory");
+        } catch (...) {
+            moveBack();
+            throw;
+        }
+        if (fs::exists(cgroup / "memory.swap.max")) // Make the limit drop caches rather than swap
+            writeControl(cgroup / "memory.swap.max", "0");
+    }
+
+    bool MemoryCgroup::hasMemoryController(const path& subtreeControl) {
+        ifstream file(subtreeControl);
+        string controller;
+        while (file >> controller)
+            if (controller == "memory")
+                return true;
+        return false;
+    }
+
+    void MemoryCgroup::moveBack() {
+        // Undo in reverse, ignoring steps that never happened. A cgroup with controllers enabled for its children
+        // can't take processes, so original's memory controller has to go before we can move back into it.
+        auto attempt = [](auto step) {
+            try { step(); } catch (const std::exception&) {}
+        };
+        attempt([&]() { writeControl(cgroup / "memory.max", "max"); });
+        if (enabledInOriginal) {
+            attempt([&]() { writeControl(group / "cgroup.subtree_control", "-memory"); });
+            attempt([&]() { writeControl(original / "cgroup.subtree_control", "-memory"); });
+        }
+        attempt([&]() { writeControl(original / "cgroup.procs", std::to_string(getpid())); });
+        std::error_code error; // Leave the cgroups behind rather than throw if we couldn't move back
+        fs::remove(cgroup, error);
+        fs::remove(group, error);
+    }
+
+    MemoryCgroup::~MemoryCgroup() {
+        moveBack();
+    }
+
+    void MemoryCgroup::limit(size_t bytes) {
+        writeControl(cgroup / "memory.max", bytes > 0 ? std::to_string(bytes) : "max");
+    }
+
+    size_t MemoryCgroup::usage() {
+        ifstream file(cgroup / "memory.current");
+        size_t bytes = 0;
+        file >> bytes;
+        return bytes;
+    }
+
+
+    vector<int> parseCpuList(const string& list) {
+        vector<int> cpus;
+        std::stringstream stream(list);
+        string part;
+        while (std::getline(stream, part, ',')) {
+            if (part.find_first_not_of(" \n") == string::npos) continue;
+            size_t dash = part.find('-');
+            int first = std::stoi(part.substr(0, dash));
+            int last = dash == string::npos ? first : std::stoi(part.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++)
+                cpus.push_back(cpu);
+        }
+        return cpus;
+    }
+
+    string formatCpuList(const vector<int>& cpus) {
+        vector<int> sorted = cpus;
+        std::sort(sorted.begin(), sorted.end());
+        vector<string> ranges;
+        for (size_t i = 0; i < sorted.size();) {
+            size_t j = i;
+            while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) j++;
+            ranges.push_back(std::to_string(sorted[i]) + (j > i ? "-" + std::to_string(sorted[j]) : ""));
+            i = j + 1;
+        }
+        return join(ranges, ",");
+    }
+
+    std::map<int, vector<int>> numaNodes() {
+        std::map<int, vector<int>> nodes;
+        path nodeDir = "/sys/devices/system/node";
+        if (!fs::is_directory(nodeDir))
+            return nodes;
+        for (auto& entry : fs::directory_iterator(nodeDir)) {
+            string name = entry.path().filename();
+            if (name.rfind("node", 0) != 0 || name.find_first_not_of("0123456789", 4) != string::npos)
+                continue;
+            ifstream file(entry.path() / "cpulist");
+            string cpulist;
+            std::getline(file, cpulist);
+            nodes[std::stoi(name.substr(4))] = parseCpuList(cpulist);
+        }
+        return nodes;
+    }
+
+    vector<int> threadAffinity() {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            throw std::runtime_error(string("sched_getaffinity failed: ") + std::strerror(errno));
+        vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set)) cpus.push_back(cpu);
+        return cpus;
+    }
+
+    void pinThread(const vector<int>& cpus) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            if (cpu < 0 || cpu >= CPU_SETSIZE)
+                throw std::runtime_error("Invalid CPU " + std::to_string(cpu));
+            CPU_SET(cpu, &set);
+        }
+        int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (error != 0)
+            throw std::runtime_error("Couldn't pin to CPUs " + formatCpuList(cpus) + ": " + std::strerror(error));
+    }
+
+    void bindMemory(const vector<int>& nodes) {
+        const int MPOL_BIND = 2; // from linux/mempolicy.h
+        vector<unsigned long> mask(1);
+        const int bits = sizeof(unsigned long) * 8;
+        for (int node : nodes) {
+            if (node < 0)
+                throw std::runtime_error("Invalid NUMA node " + std::to_string(node));
+            if ((size_t) node / bits >= mask.size())
+                mask.resize(node / bits + 1);
+            mask[node / bits] |= 1UL << (node % bits);
+        }
+        if (syscall(SYS_set_mempolicy, MPOL_BIND, mask.data(), mask.size() * bits + 1) != 0)
+            throw std::runtime_error(string("set_mempolicy failed: ") + std::strerror(errno));
+    }
+
+    string describeTopology() {
+        vector<string> parts;
+        for (auto& [node, cpus] : numaNodes())
+            parts.push_back("node" + std::to_string(node) + " cpus " + formatCpuList(cpus));
+        if (parts.empty())
+            parts.push_back("no NUMA nodes");
+        parts.push_back("affinity " + formatCpuList(threadAffinity()));
+        return join(parts, "; ");
+    }
+
+    FileSystemInfo fileSystemInfo(const path& filepath) {
+        struct statfs stats;
+        if (statfs(filepath.c_str(), &stats) != 0)
+            throw std::runtime_error("statfs " + filepath.native() + " failed: " + std::strerror(errno));
+        FileSystemInfo info;
+        info.available = (size_t) stats.f_bavail * stats.f_bsize;
+
+        const std::map<long, string> magicNames{
+            {0xEF53, "ext4"}, {0x58465342, "xfs"}, {0x01021994, "tmpfs"}, {0x9123683E, "btrfs"},
+            {0xF2F52010, "f2fs"}, {0x6969, "nfs"}, {0x794C7630, "overlay"}, {0x2FC12FC1, "zfs"},
+        };
+        auto magic = magicNames.find((long) stats.f_type);
+        std::stringstream hex;
+        hex << "0x" << std::hex << stats.f_type;
+        info.type = magic != magicNames.end() ? magic->second : hex.str();
+
+        // Lines look like "36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw,errors=continue"
+        path target = fs::canonical(filepath);
+        ifstream mountinfo("/proc/self/mountinfo");
+        string line;
+        while (std::getline(mountinfo, line)) {
+            std::stringstream fields(line);
+            string id, parent, device, root, mountPoint, options, field;
+            fields >> id >> parent >> device >> root >> mountPoint >> options;
+            while (fields >> field && field != "-") {} // optional fields
+            string type, source, superOptions;
+            fields >> type >> source >> superOptions;
+
+            auto relative = target.lexically_relative(mountPoint);
+            bool contains = !relative.empty() && *relative.begin() != "..";
+            if (contains && mountPoint.size() >= info.mountPoint.size()) { // later mounts shadow earlier ones
+                info.type = type;
+                info.mountPoint = mountPoint;
+                info.options = options + (superOptions.empty() ? "" : "," + superOptions);
+            }
+        }
+        return info;
+    }
+
+    string incrementCounter(const string& value) {
+        string newValue = value;
+        if (newValue.size() < sizeof(uint64_t))
+            newValue.resize(sizeof(uint64_t), '\0');
+        uint64_t counter = 0;
+        for (size_t i = 0; i < sizeof(uint64_t); i++)
+            counter |= (uint64_t) (unsigned char) newValue[i] << (8 * i);
+        counter++;
+        for (size_t i = 0; i < sizeof(uint64_t); i++)
+            newValue[i] = (char) (counter >> (8 * i));
+        return newValue;
+    }
+
     string prettySize(size_t size) {
         vector<string> units{"B", "KiB", "MiB", "GiB"};
         int unitI = std::min<size_t>(std::log(size) / std::log(1024), units.size());
@@ -162,7 +623,61 @@ namespace utils {
         ss << std::setprecision(leftOfDecimal + 2) << sizeInUnit << units[unitI];
         return ss.str();
     }
-}
 
+    double zScore(double confidence) {
+        // Invert the normal CDF by bisection, it's only called a few times per measurement
+        double target = 1 - (1 - confidence) / 2;
+        double low = 0, high = 10;
+        for (int i = 0; i < 64; i++) {
+            double mid = (low + high) / 2;
+            (0.5 * std::erfc(-mid / std::sqrt(2)) < target ? low : high) = mid;
+        }
+        return low;
+    }
 
+    MannWhitneyResult mannWhitneyU(const vector<long long>& a, const vector<long long>& b) {
+        // Rank a and b together, giving tied values the average of their ranks
+        vector<std::pair<long long, bool>> values; // value, whether it's from a
+        for (auto value : a) values.push_back({value, true});
+        for (auto value : b) values.push_back({value, false});
+        std::sort(values.begin(), values.end());
+
+        double n1 = a.size(), n2 = b.size(), n = values.size();
+        double rankSumA = 0, ties = 0;
+        for (size_t i = 0; i < values.size();) {
+            size_t j = i;
+            while (j < values.size() && values[j].first == values[i].first)
+                j++;
+            double rank = (i + 1 + j) / 2.0, tied = j - i;
+            for (size_t k = i; k < j; k++)
+                if (values[k].second) rankSumA += rank;
+            ties += tied * tied * tied - tied;
+            i = j;
+        }
 
+        double u = rankSumA - n1 * (n1 + 1) / 2;
+        double mean = n1 * n2 / 2;
+        double variance = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+        if (variance <= 0) // all the values are the same
+            return {u, 0, 1};
+        double diff = u - mean;
+        double corrected = std::max(std::abs(diff) - 0.5, 0.0); // continuity correction
+        double z = std::copysign(corrected, diff) / std::sqrt(variance);
+        return {u, z, std::erfc(std::abs(z) / std::sqrt(2))};
+    }
+
+    string formatNumber(double num) {
+        if (num == std::floor(num) && std::abs(num) < 1e18)
+            return std::to_string((long long) num);
+        std::stringstream ss;
+        ss << std::setprecision(6) << num;
+        return ss.str();
+    }
+
+    string join(const vector<string>& strings, const string& sep) {
+        string joined;
+        for (size_t i = 0; i < strings.size(); i++)
+            joined += (i > 0 ? sep : "") + strings[i];
+        return joined;
+    }
+}
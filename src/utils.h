@@ -8,14 +8,64 @@
 #include <filesystem>
 #include <chrono>
 #include <random>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <map>
 
 namespace utils {
     /** Represents a range of numeric values, inclusive, [min, max] */
     template<typename T>
     struct Range { T min; T max; };
 
+    /**
+     * A fast, seedable pseudo random generator (wyrand). Much faster than mt19937 for filling buffers with random
+     * bytes since each output only depends on a counter, so consecutive outputs can be computed in parallel by the CPU.
+     * It satisfies UniformRandomBitGenerator so it can be used with the std distributions.
+     * See https://github.com/wangyi-fudan/wyhash
+     */
+    class FastRand {
+        uint64_t state;
+
+        static uint64_t mix(uint64_t x) {
+            __uint128_t product = (__uint128_t) x * (x ^ 0xe7037ed1a0b428dbULL);
+            return (uint64_t) (product >> 64) ^ (uint64_t) product;
+        }
+
+    public:
+        using result_type = uint64_t;
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return UINT64_MAX; }
+
+        FastRand(uint64_t seed) : state(seed) {}
+
+        result_type operator()() {
+            state += 0xa0761d6478bd642fULL;
+            return mix(state);
+        }
+
+        /** Fills buffer with random bytes, 8 at a time */
+        void fill(char* buffer, size_t size);
+    };
+
     extern std::random_device randomDevice;
-    extern std::mt19937 randGen;
+
+    /**
+     * Random generators local to each thread, so data can be generated in parallel. Each thread's generators are
+     * seeded from the run seed (see `seed`) and the order in which threads first use them.
+     */
+    extern thread_local std::mt19937 randGen;
+    extern thread_local FastRand fastRand;
+
+    /**
+     * Sets the seed for the run so that generated data is reproducible. Reseeds the calling thread's generators, and
+     * any thread that starts using its generators afterwards.
+     */
+    void seed(uint64_t seed);
+
+    /** The seed of the run. Random unless `seed` is called. */
+    uint64_t getSeed();
 
     /** Random int in range on interval (inclusive) */
     template<typename T>
@@ -24,21 +74,91 @@ namespace utils {
         return randRange(randGen);
     }
 
+    /** Picks value sizes within a Range. Distributions other than uniform are truncated to the range. */
+    class SizeDistribution {
+    public:
+        virtual ~SizeDistribution() {}
+
+        /** Pick a random size in range */
+        virtual size_t operator()(Range<size_t> range) = 0;
+    };
+
+    /** Picks sizes evenly from the range */
+    class UniformSize : public SizeDistribution {
+    public:
+        size_t operator()(Range<size_t> range) override;
+    };
+
+    /** Always picks the same size, or the middle of the range if size is 0 */
+    class FixedSize : public SizeDistribution {
+        size_t size;
+    public:
+        FixedSize(size_t size = 0);
+        size_t operator()(Range<size_t> range) override;
+    };
+
+    /**
+     * Picks sizes from a log-normal distribution with its median at the geometric middle of the range. Most sizes
+     * will be near the median with a long tail of larger ones.
+     * @param sigma The standard deviation of the log of the size
+     */
+    class LogNormalSize : public SizeDistribution {
+        double sigma;
+    public:
+        LogNormalSize(double sigma);
+        size_t operator()(Range<size_t> range) override;
+    };
+
+    /**
+     * Picks sizes from a Pareto distribution starting at range.min, so most are small with a few very large.
+     * @param alpha The shape of the distribution. 1.16 gives the "80-20" rule.
+     */
+    class ParetoSize : public SizeDistribution {
+        double alpha;
+    public:
+        ParetoSize(double alpha);
+        size_t operator()(Range<size_t> range) override;
+    };
+
+    /**
+     * Picks sizes from a histogram of real record sizes. The histogram file has a line per bucket with the min and
+     * max size (inclusive) and a weight, e.g. "1024 2047 31.5". Lines starting with "#" are ignored. Only the part of
+     * the histogram that overlaps the range is used, or a uniform size if the histogram has nothing in the range.
+     */
+    class EmpiricalSize : public SizeDistribution {
+        struct Bucket { Range<size_t> size; double weight; };
+        std::vector<Bucket> buckets;
+    public:
+        EmpiricalSize(const std::filesystem::path& histogramFile);
+        size_t operator()(Range<size_t> range) override;
+    };
+
     /** Generate a random, incompressible, binary string of the given size */
     std::string randBlob(size_t size);
 
+    /** Fill preallocated storage with random, incompressible, binary data */
+    void randBlob(char* buffer, size_t size);
+
     /** Generate a random, incompressible, binary string within the given size range */
     std::string randBlob(Range<size_t> size);
 
-    /** Class to generate a random, compressible, text string */
+    /**
+     * Class to generate a random, compressible, text string. The text files are memory-mapped once and shared between
+     * copies of the generator, and it is safe to use from multiple threads.
+     */
     class ClobGenerator {
     private:
-        std::filesystem::path textFolder;
-        struct FileInfo {
-            std::filesystem::path file; size_t size;
+        /** The text files memory-mapped, conceptually concatenated together. */
+        struct Corpus {
+            struct MappedFile { const char* data; size_t size; };
+            std::vector<MappedFile> files;
+            /** offsets[i] is the position of files[i] in the concatenated corpus, for binary search */
+            std::vector<size_t> offsets;
+            size_t totalSize = 0;
+
+            ~Corpus();
         };
-        std::vector<FileInfo> fileSizes;
-        size_t filesTotalSize;
+        std::shared_ptr<const Corpus> corpus;
     public:
         /** Creates the clob, chooses text from files in the given folder */
         ClobGenerator(const std::filesystem::path& textFolder);
@@ -48,10 +168,16 @@ namespace utils {
 
         /** Generate a random, compressible, text string within the given size range */
         std::string operator()(Range<size_t> size); 
+
+        /** Fill preallocated storage with random, compressible, text */
+        void fill(char* buffer, size_t size);
     };
 
     std::string intToHex(long long i, int width);
 
+    /** Lowercase hex encoding of bytes, two characters per byte */
+    std::string toHex(const std::string& bytes);
+
     std::string randHash(int size);
 
     /**
@@ -60,9 +186,49 @@ namespace utils {
      */
     std::string genKey(size_t i);
 
+    /**
+     * Generates the key for the i-th record in a given format and order, for keys that are sorted, time ordered, or
+     * more compact than `genKey`'s. Formats:
+     * - "hex": `genKey`, 32 hex characters of a hash
+     * - "binary": the 16 bytes of the same hash, not hex encoded
+     * - "varint": an order preserving varint: a byte with the number of bytes that follow, then the number in big
+     *   endian without leading zeros, so 1 to 9 bytes
+     * - "uuidv7": 32 hex characters laid out like a UUIDv7, a 48 bit millisecond timestamp (a fixed start time plus
+     *   the number) followed by the version and bits of a hash of the number
+     * Orders, which decide the number that is encoded:
+     * - "sequential": i itself, so each record's key sorts after the previous one
+     * - "random": a fixed shuffle of i. It's a bijection on [0, 2^40) so the keys stay unique.
+     * The hashed formats are in random order either way, and ignore the order, see `hasOrder`.
+     */
+    class KeyGenerator {
+        enum class Format { Hex, Binary, Varint, UuidV7 };
+        Format formatId;
+        bool shuffle;
+
+    public:
+        std::string format;
+        std::string order;
+
+        KeyGenerator(const std::string& format = "hex", const std::string& order = "random");
+
+        /** Whether the order changes format's keys. hex and binary keys are hashes, so they're random either way. */
+        static bool hasOrder(const std::string& format);
+
+        std::string operator()(size_t i) const;
+    };
+
     /** Returns the time taken to run func */
     std::chrono::nanoseconds timeIt(std::function<void()> func);
 
+    /** Like `timeIt`, but func is inlined rather than called through a `std::function` */
+    template<typename Func>
+    inline std::chrono::nanoseconds timeInline(Func&& func) {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto stop = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start);
+    }
+
 
     const size_t KiB __attribute__((unused)) = 1024;
     const size_t MiB __attribute__((unused)) = 1024 * KiB;
@@ -74,6 +240,23 @@ namespace utils {
      */
     long long diskUsage(const std::filesystem::path& filepath);
 
+    /** The file system a path is on */
+    struct FileSystemInfo {
+        /** e.g. "ext4", "xfs", or "tmpfs" */
+        std::string type;
+        std::string mountPoint;
+        /** The mount and super block options, e.g. "rw,relatime,seclabel" */
+        std::string options;
+        /** Bytes available to unprivileged users */
+        size_t available;
+    };
+
+    /**
+     * Finds the file system filepath (which must exist) is on with `statfs` and the most specific mount containing
+     * it in /proc/self/mountinfo. Falls back to the `statfs` magic number as the type if mountinfo isn't readable.
+     */
+    FileSystemInfo fileSystemInfo(const std::filesystem::path& filepath);
+
     /**
      * Gets the peak memory usage of the process so far, in kilobytes.
      * Uses the `getrusage` syscall. You can use `resetPeakMemUsage` to reset the peak memory and get the peak memory
@@ -81,15 +264,90 @@ namespace utils {
      */
     size_t getPeakMemUsage();
 
+    /** Gets the current resident set size of the process in kilobytes, from /proc/self/statm */
+    size_t getMemUsage();
+
     /**
      * Reset the peak memory usage, so we can get the peak memory for an interval)
      */
     void resetPeakMemUsage();
 
+    /**
+     * Moves the process into a new cgroup v2 under its current one, so its memory can be limited. Unlike engine cache
+     * settings, the cgroup limit also covers the kernel page cache for files the process reads and writes. Moves the
+     * process back and removes the cgroup when destroyed.
+     *
+     * cgroup v2 only lets a cgroup without processes enable controllers for its children, so the process moves into
+     * a leaf (original/kv-benchmark-<pid>/benchmark) before the memory controller is enabled on the way down to it.
+     * If the original cgroup has other processes and doesn't have the memory controller enabled already, this fails.
+     */
+    class MemoryCgroup {
+        std::filesystem::path original;
+        /** The cgroup we create under original, and the leaf under it the process runs in */
+        std::filesystem::path group;
+        std::filesystem::path cgroup;
+        /** Whether we enabled the memory controller in original, so it has to be disabled again to move back */
+        bool enabledInOriginal = false;
+
+    public:
+        /** Throws if cgroup v2 isn't mounted, or the current cgroup isn't writable or can't enable memory control */
+        MemoryCgroup();
+        ~MemoryCgroup();
+
+        /** Sets the memory limit (memory.max) in bytes. 0 for no limit */
+        void limit(size_t bytes);
+
+        /** Current memory usage of the cgroup in bytes, including page cache */
+        size_t usage();
+
+    private:
+        static bool hasMemoryController(const std::filesystem::path& subtreeControl);
+        /** Lifts the limit and moves the process back to original, as far as it can */
+        void moveBack();
+    };
+
+
+    /** Parses a CPU or node list in the kernel's format, e.g. "0-3,8,10-11" */
+    std::vector<int> parseCpuList(const std::string& list);
+
+    /** Formats a CPU or node list in the kernel's format, e.g. "0-3,8,10-11" */
+    std::string formatCpuList(const std::vector<int>& cpus);
+
+    /** The CPUs of each NUMA node, from sysfs. Empty if the kernel doesn't expose NUMA nodes. */
+    std::map<int, std::vector<int>> numaNodes();
+
+    /** The CPUs the calling thread may run on */
+    std::vector<int> threadAffinity();
+
+    /** Pins the calling thread to cpus. Threads it creates afterwards inherit the affinity. */
+    void pinThread(const std::vector<int>& cpus);
+
+    /**
+     * Binds the calling thread's memory allocations to the given NUMA nodes with `set_mempolicy(MPOL_BIND)`, using
+     * the raw syscall so we don't need libnuma. Threads it creates afterwards inherit the policy. Throws if the
+     * system doesn't support NUMA policies or doesn't have the nodes.
+     */
+    void bindMemory(const std::vector<int>& nodes);
+
+    /** Describes the NUMA nodes and the calling thread's affinity, e.g. "node0 cpus 0-15; node1 cpus 16-31; ..." */
+    std::string describeTopology();
+
+
+    /**
+     * Treats the first 8 bytes of value as a little endian counter and returns value with it incremented, for use as
+     * a read-modify-write. Values shorter than 8 bytes are padded with zeros.
+     */
+    std::string incrementCounter(const std::string& value);
 
     /** Convert size in bytes to a human readable string. */
     std::string prettySize(std::size_t size);
 
+    /** Formats whole numbers without a decimal point or exponent, and other numbers with up to 6 significant digits */
+    std::string formatNumber(double num);
+
+    /** Joins strings with the separator between each of them */
+    std::string join(const std::vector<std::string>& strings, const std::string& sep);
+
 
     /** Keeps the average and other statistics. */
     template<typename T>
@@ -118,6 +376,15 @@ namespace utils {
             for (T record : records) this->record(record);
         }
 
+        /** Combine the records from other into this */
+        void merge(const Stats& other) {
+            if (other._count == 0) return;
+            _sum += other._sum;
+            if (_count == 0 || other._min < _min) _min = other._min;
+            if (_count == 0 || other._max > _max) _max = other._max;
+            _count += other._count;
+        }
+
         long long count() const { return _count; }
         T sum() const { return _sum; }
         T min() const { return _min; }
@@ -125,6 +392,82 @@ namespace utils {
         /** Note: Throws divide by zero if you haven't recording anything */
         T avg() const { return _sum / _count; }
     };
+
+    /**
+     * Returns the pth percentile (0 to 100) of values using the nearest-rank method. Partially reorders values.
+     * Note: values should not be empty.
+     */
+    template<typename T>
+    T percentile(std::vector<T>& values, double p) {
+        size_t rank = std::ceil(p / 100 * values.size());
+        size_t i = std::min(rank > 0 ? rank - 1 : 0, values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + i, values.end());
+        return values[i];
+    }
+
+    /** A confidence interval for a statistic of some samples */
+    struct ConfidenceInterval {
+        /** The statistic, e.g. "mean" or "p99" */
+        std::string statistic;
+        double estimate;
+        double low;
+        double high;
+
+        /** Half the width of the interval relative to the estimate */
+        double relativeError() const {
+            return estimate != 0 ? (high - low) / 2 / std::abs(estimate) : INFINITY;
+        }
+    };
+
+    /** Returns the z score for a two-sided confidence level, e.g. 1.96 for 0.95 */
+    double zScore(double confidence);
+
+    /** Confidence interval of the mean of values using the normal approximation. Note: values should not be empty. */
+    template<typename T>
+    ConfidenceInterval meanConfidenceInterval(const std::vector<T>& values, double confidence) {
+        double n = values.size();
+        double mean = 0, variance = 0;
+        for (auto value : values) mean += value;
+        mean /= n;
+        for (auto value : values) variance += (value - mean) * (value - mean);
+        variance /= std::max(n - 1, 1.0);
+        double halfWidth = zScore(confidence) * std::sqrt(variance / n);
+        return {"mean", mean, mean - halfWidth, mean + halfWidth};
+    }
+
+    /**
+     * Distribution-free confidence interval of the pth percentile (0 to 100) of values, from the order statistics
+     * around it. Sorts values. Note: values should not be empty.
+     */
+    template<typename T>
+    ConfidenceInterval percentileConfidenceInterval(std::vector<T>& values, double p, double confidence) {
+        std::sort(values.begin(), values.end());
+        double n = values.size(), q = p / 100;
+        double spread = zScore(confidence) * std::sqrt(n * q * (1 - q));
+        auto at = [&](double rank) { // 1-based rank, clamped to the samples we have
+            return (double) values[std::clamp<long long>(rank, 1, values.size()) - 1];
+        };
+        return {"p" + formatNumber(p), at(std::ceil(n * q)), at(std::floor(n * q - spread)),
+                at(std::ceil(n * q + spread))};
+    }
+
+    /** The result of a Mann-Whitney U test, see `mannWhitneyU` */
+    struct MannWhitneyResult {
+        /** The number of pairs (x from a, y from b) where x > y, counting ties as half */
+        double u;
+        /** U standardized with the normal approximation. Positive if values from a tend to be larger. */
+        double z;
+        /** Two-sided p value of a and b coming from the same distribution */
+        double p;
+    };
+
+    /**
+     * Mann-Whitney U test of whether values from a tend to be larger or smaller than values from b. Unlike a t-test
+     * it doesn't assume the values are normally distributed, which latencies with their long tails aren't. Uses the
+     * normal approximation with tie and continuity corrections, which is accurate once both have more than ~20
+     * values. Note: a and b should not be empty.
+     */
+    MannWhitneyResult mannWhitneyU(const std::vector<long long>& a, const std::vector<long long>& b);
 }
 
 